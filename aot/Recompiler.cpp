@@ -0,0 +1,453 @@
+#include <array>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "../include/AotRuntime.hpp"
+#include "../include/Debugger.hpp"
+
+// chip-8-aot: static recompiler turning a ROM into C++ that AotRuntime runs.
+// Control flow is recovered by following jumps, calls, returns and skips from
+// the entry point; every address reached that way starts a block, which runs
+// straight-line code with the registers in locals and leaves through a side
+// exit at every taken skip. Blocks end at jumps, calls, returns and BNNN, and
+// stop before FX0A, which the interpreter runs. Exits to a known address call
+// the next block directly (as a tail call), so loops stay in compiled code
+// until the budget runs out. Computed BNNN targets other than NNN itself are
+// not known here and go back through the dispatcher.
+
+#define AOT_ROM_START_OFFSET 0x0200 // Same as chip-8
+
+namespace {
+
+std::string hex(unsigned int value, int digits) {
+    char text[16];
+    snprintf(text, sizeof(text), "0x%0*X", digits, value);
+    return text;
+}
+std::string function(unsigned int address) { return "block" + hex(address, 3).substr(2); }
+std::string reg(unsigned int index) {
+    char text[4];
+    snprintf(text, sizeof(text), "v%X", index);
+    return text;
+}
+
+struct Rom {
+    std::vector<uint8_t> data;
+    uint16_t start;
+
+    // Whether both bytes of the instruction at the address are part of the ROM
+    bool contains(unsigned int address) const { return address >= start && address+1 < start+data.size(); }
+    uint16_t opcode(unsigned int address) const { return (data[address-start] << 8) | data[address-start+1]; }
+};
+
+// Addresses at which the interpreter has to take over from a block
+bool interpreted(uint16_t opcode) { return (opcode & 0xF0FF) == 0xF00A; }
+
+// Follow every statically known path from the entry point and return the addresses starting a block
+std::set<uint16_t> findBlocks(Rom const &rom) {
+    std::set<uint16_t> blocks;
+    std::set<uint16_t> seen;
+    std::deque<uint16_t> pending = {rom.start};
+    while (!pending.empty()) {
+        uint16_t const start = pending.front();
+        pending.pop_front();
+        if (!seen.insert(start).second) continue;
+        auto follow = [&](unsigned int address) { if (rom.contains(address)) pending.push_back(address); };
+
+        unsigned int address = start;
+        for (int count = 0; ; count++) {
+            if (!rom.contains(address)) break;
+            if (count == AOT_MAX_BLOCK_INSTRUCTIONS) {
+                follow(address);
+                break;
+            }
+            uint16_t const opcode = rom.opcode(address);
+            if (interpreted(opcode)) {
+                follow(address+2);
+                break;
+            }
+            if (count == 0) blocks.insert(start);
+            unsigned int const nnn = opcode & 0x0FFF;
+            unsigned int const nn = opcode & 0x00FF;
+            bool end = false;
+            switch (opcode >> 12) {
+                case 0x0: end = opcode == 0x00EE; break;
+                case 0x1: follow(nnn); end = true; break;
+                case 0x2: follow(nnn); follow(address+2); end = true; break;
+                case 0x3: case 0x4: case 0x9: follow(address+4); break;
+                // 5XX0 always skips
+                case 0x5: follow(address+4); end = ((opcode >> 8) & 0xF) == ((opcode >> 4) & 0xF); break;
+                case 0xB: follow(nnn); end = true; break;
+                case 0xE: if (nn == 0x9E || nn == 0xA1) follow(address+4); break;
+                default: break;
+            }
+            if (end) break;
+            address += 2;
+        }
+    }
+    return blocks;
+}
+
+// Writes the function for one block, keeping V0-VF and I in locals
+// that are only stored back before leaving or calling into the runtime
+class BlockWriter {
+    private:
+        Rom const &rom;
+        std::map<uint16_t, size_t> const &blocks;  // Index of the block starting at each address
+        uint16_t const start;
+        std::ostringstream body;
+        std::array<bool, 16> used;
+        std::array<bool, 16> dirty;
+        bool usesI;
+        bool dirtyI;
+        uint16_t end;
+
+        std::string use(unsigned int x) {
+            used[x] = true;
+            return reg(x);
+        }
+        std::string set(unsigned int x) {
+            used[x] = true;
+            dirty[x] = true;
+            return reg(x);
+        }
+        std::string writeback() const {
+            std::string code;
+            for (unsigned int x = 0; x < 16; x++) {
+                if (dirty[x]) code += "rt.V[" + hex(x, 1) + "] = " + reg(x) + "; ";
+            }
+            if (dirtyI) code += "rt.I = i; ";
+            return code;
+        }
+        // Store the locals back before the runtime reads them
+        void sync() {
+            std::string const code = writeback();
+            if (!code.empty()) body << "    " << code.substr(0, code.size()-1) << "\n";
+            dirty.fill(false);
+            dirtyI = false;
+        }
+        // Budget left after running `count` instructions, continuing straight into
+        // the block at the address if there is one and it is still valid
+        std::string chain(unsigned int address, int count) const {
+            std::string const left = "budget-" + std::to_string(count);
+            std::map<uint16_t, size_t>::const_iterator block = blocks.find(address);
+            if (block == blocks.end()) return left;
+            return "budget > " + std::to_string(count) + " && rt.isValid(" + std::to_string(block->second) + ") ? "
+                + function(address) + "(rt, " + left + ") : " + left;
+        }
+        std::string exit(unsigned int address, int count, bool chained = true) const {
+            address &= 0xFFFF;
+            return "{ " + writeback() + "rt.pc = " + hex(address, 3) + "; return "
+                + (chained ? chain(address, count) : "budget-" + std::to_string(count)) + "; }";
+        }
+        void exitIf(std::string const &condition, unsigned int address, int count, bool chained = true) {
+            body << "    if (" << condition << ") " << exit(address, count, chained) << "\n";
+        }
+        void statement(std::string const &code) { body << "    " << code << "\n"; }
+
+        // Emit one instruction, return false if the block ends with it
+        bool instruction(uint16_t address, uint16_t opcode, int count) {
+            unsigned int const x = (opcode >> 8) & 0xF;
+            unsigned int const y = (opcode >> 4) & 0xF;
+            unsigned int const n = opcode & 0xF;
+            unsigned int const nn = opcode & 0xFF;
+            unsigned int const nnn = opcode & 0xFFF;
+            unsigned int const next = address+2;
+            switch (opcode >> 12) {
+                case 0x0:
+                    if (opcode == 0x00E0) statement("rt.clearScreen();");
+                    else if (opcode == 0x00EE) {
+                        sync();
+                        statement("rt.pc = " + hex(next, 3) + "; rt.ret(); return budget-" + std::to_string(count) + ";");
+                        return false;
+                    }
+                    break;
+                case 0x1:
+                    statement(exit(nnn, count));
+                    return false;
+                case 0x2:
+                    sync();
+                    statement("if (!rt.call(" + hex(next, 3) + ", " + hex(nnn, 3) + ")) return budget-" + std::to_string(count) + ";");
+                    statement("return " + chain(nnn, count) + ";");
+                    return false;
+                case 0x3: exitIf(use(x) + " == " + hex(nn, 2), address+4, count); break;
+                case 0x4: exitIf(use(x) + " != " + hex(nn, 2), address+4, count); break;
+                case 0x5:
+                    // 5XX0 always skips, and the generated comparison would be tautological
+                    if (x == y) {
+                        statement(exit(address+4, count));
+                        return false;
+                    }
+                    exitIf(use(x) + " == " + use(y), address+4, count);
+                    break;
+                case 0x6: statement(set(x) + " = " + hex(nn, 2) + ";"); break;
+                case 0x7: statement(set(x) + " += " + hex(nn, 2) + ";"); break;
+                case 0x8: {
+                    static char const *const logic[4] = {" = ", " |= ", " &= ", " ^= "};
+                    if (n <= 0x3) {
+                        // VF is reset like on the COSMAC VIP interpreter
+                        std::string const vy = use(y);
+                        statement(set(x) + logic[n] + vy + "; " + set(0xF) + " = 0;");
+                    } else if (n == 0x4 || n == 0x5 || n == 0x7) {
+                        std::string const vx = set(x);
+                        std::string const vy = use(y);
+                        std::string const vf = set(0xF);
+                        std::string const flag = n == 0x4 ? "x+y > 0xFF" : n == 0x5 ? "x >= y" : "y >= x";
+                        std::string const result = n == 0x4 ? "x+y" : n == 0x5 ? "x-y" : "y-x";
+                        statement("{ uint8_t x = " + vx + ", y = " + vy + "; " + vx + " = " + result + "; " + vf + " = " + flag + "; }");
+                    } else if (n == 0x6 || n == 0xE) {
+                        std::string const vy = use(y);
+                        std::string const shift = n == 0x6 ? " >> 1; " : " << 1; ";
+                        std::string const flag = n == 0x6 ? "y & 0x01" : "y >> 7";
+                        statement("{ uint8_t y = " + vy + "; " + set(x) + " = y" + shift + set(0xF) + " = " + flag + "; }");
+                    }
+                    break;
+                }
+                case 0x9: if (x != y) exitIf(use(x) + " != " + use(y), address+4, count); break;  // 9XX0 never skips
+                case 0xA:
+                    usesI = dirtyI = true;
+                    statement("i = " + hex(nnn, 3) + ";");
+                    break;
+                case 0xB:
+                    use(0);
+                    statement("{ " + writeback() + "rt.pc = " + hex(nnn, 3) + " + v0; return budget-" + std::to_string(count) + "; }");
+                    return false;
+                case 0xC: statement(set(x) + " = rt.random(" + hex(nn, 2) + ");"); break;
+                case 0xD:
+                    use(0xF);
+                    sync();
+                    statement("rt.execute(" + hex(opcode, 4) + "); vF = rt.V[0xF];");
+                    break;
+                case 0xE:
+                    if (nn == 0x9E) exitIf("rt.skipIfPressed(" + use(x) + ")", address+4, count);
+                    else if (nn == 0xA1) exitIf("rt.skipIfNotPressed(" + use(x) + ")", address+4, count);
+                    break;
+                case 0xF:
+                    switch (nn) {
+                        case 0x07: statement(set(x) + " = rt.delayTimer;"); break;
+                        case 0x15: statement("rt.delayTimer = " + use(x) + ";"); break;
+                        case 0x18: statement("rt.soundTimer = " + use(x) + ";"); break;
+                        case 0x1E:
+                            usesI = dirtyI = true;
+                            statement("i += " + use(x) + ";");
+                            break;
+                        case 0x29:
+                            usesI = dirtyI = true;
+                            statement("i = rt.fontStartOffset + " + use(x) + "*5;");
+                            break;
+                        case 0x33:
+                        case 0x55:
+                        case 0x65: {
+                            sync();
+                            std::string reload;
+                            if (nn != 0x33) {
+                                usesI = true;
+                                reload += " i = rt.I;";
+                            }
+                            if (nn == 0x65) {
+                                for (unsigned int r = 0; r <= x; r++) reload += " " + use(r) + " = rt.V[" + hex(r, 1) + "];";
+                            }
+                            statement("rt.execute(" + hex(opcode, 4) + ");" + reload);
+                            // The store may have overwritten the rest of this block
+                            if (nn != 0x65) exitIf("rt.codeModified", next, count, false);
+                            break;
+                        }
+                        default: break;
+                    }
+                    break;
+            }
+            return true;
+        }
+
+    public:
+        BlockWriter(Rom const &rom, std::map<uint16_t, size_t> const &blocks, uint16_t start) : rom(rom), blocks(blocks), start(start), used{false}, dirty{false},
+            usesI(false), dirtyI(false), end(start) {}
+
+        void write(std::ostream &out) {
+            unsigned int address = start;
+            int count = 0;
+            bool open = true;
+            while (open) {
+                if (!rom.contains(address) || count == AOT_MAX_BLOCK_INSTRUCTIONS || interpreted(rom.opcode(address))) {
+                    statement(exit(address, count));
+                    break;
+                }
+                if (count > 0) exitIf("budget == " + std::to_string(count), address, count, false);
+                uint16_t const opcode = rom.opcode(address);
+                body << "    // " << hex(address, 3) << ": " << hex(opcode, 4).substr(2) << " " << disassemble(opcode) << "\n";
+                count++;
+                open = instruction(address, opcode, count);
+                address += 2;
+            }
+            end = address;
+
+            out << "// " << hex(start, 3) << "-" << hex(end-1, 3) << "\n";
+            out << "uint32_t " << function(start) << "(AotRuntime &rt, uint32_t budget) {\n";
+            for (unsigned int x = 0; x < 16; x++) {
+                if (used[x]) out << "    [[maybe_unused]] uint8_t " << reg(x) << " = rt.V[" << hex(x, 1) << "];\n";
+            }
+            if (usesI) out << "    [[maybe_unused]] uint16_t i = rt.I;\n";
+            out << body.str() << "}\n\n";
+        }
+        uint16_t getEnd() const { return end; }
+};
+
+// Turn a file name into a C++ identifier, e.g. "roms/TETRIS.ch8" into "tetris"
+std::string programName(std::string const &path) {
+    std::string name = path.substr(path.find_last_of('/')+1);
+    name = name.substr(0, name.find('.'));
+    std::string identifier;
+    for (char c : name) identifier += std::isalnum((unsigned char)c) ? std::tolower((unsigned char)c) : '_';
+    if (identifier.empty() || std::isdigit((unsigned char)identifier[0])) identifier = "rom" + identifier;
+    return identifier;
+}
+
+void writeDriver(std::ostream &out, std::string const &symbol) {
+    out << "// Headless driver: run the ROM for --frames frames and print the final screen\n"
+        "int main(int argc, char *argv[]) {\n"
+        "    uint64_t frames = 600;\n"
+        "    uint16_t clockSpeed = 900;\n"
+        "    bool interpret = false;\n"
+        "    for (int i = 1; i < argc; i++) {\n"
+        "        if (strcmp(argv[i], \"--frames\") == 0 && i+1 < argc) frames = std::stoull(argv[++i]);\n"
+        "        else if (strcmp(argv[i], \"--clock-speed\") == 0 && i+1 < argc) clockSpeed = std::stoi(argv[++i]);\n"
+        "        else if (strcmp(argv[i], \"--interpret\") == 0) interpret = true;\n"
+        "        else {\n"
+        "            std::cerr << \"Usage: \" << argv[0] << \" [--frames N] [--clock-speed HZ] [--interpret]\" << std::endl;\n"
+        "            return EXIT_FAILURE;\n"
+        "        }\n"
+        "    }\n"
+        "    Chip8Config config = {\n"
+        "        .terminalMode = false,\n"
+        "        .clockSpeed = clockSpeed,\n"
+        "        .refreshRate = 60,\n"
+        "        .romStartOffset = " << symbol << ".romStartOffset,\n"
+        "        .fontStartOffset = 0x0050\n"
+        "    };\n"
+        "    Chip8 chip8 = Chip8(config);\n"
+        "    if (!chip8.loadRom(" << symbol << ".rom, " << symbol << ".romSize)) return EXIT_FAILURE;\n"
+        "    if (!interpret && !chip8.useAotProgram(" << symbol << ")) return EXIT_FAILURE;\n"
+        "\n"
+        "    std::chrono::time_point const start = std::chrono::steady_clock::now();\n"
+        "    for (uint64_t frame = 0; frame < frames; frame++) chip8.runFrame();\n"
+        "    std::chrono::duration<double, std::milli> const elapsed = std::chrono::steady_clock::now()-start;\n"
+        "\n"
+        "    std::array<bool, SCREEN_SIZE_X*SCREEN_SIZE_Y> const &screen = chip8.getScreen();\n"
+        "    for (int y = 0; y < SCREEN_SIZE_Y; y++) {\n"
+        "        for (int x = 0; x < SCREEN_SIZE_X; x++) std::cout << (screen[y*SCREEN_SIZE_X+x] ? '#' : '.');\n"
+        "        std::cout << \"\\n\";\n"
+        "    }\n"
+        "    std::cout << " << symbol << ".name << \": \" << frames << \" frames in \" << elapsed.count() << \" ms\" << std::endl;\n"
+        "    return EXIT_SUCCESS;\n"
+        "}\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    char const *romPath = nullptr;
+    char const *outputPath = nullptr;
+    std::string name;
+    bool driver = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+            std::cout << "Usage: chip-8-aot [OPTIONS] ROM OUTPUT\n\nRecompile ROM into the C++ file OUTPUT, which defines\n"
+                "`extern AotProgram const NAMEProgram` to pass to Chip8::useAotProgram().\n\nwith options:\n"
+                "--name NAME\nIdentifier to name the program after. Default is the ROM file name, e.g. tetris.\n"
+                "--main\nAlso emit a main() running the ROM headless, see chip8_add_aot_executable() in CMakeLists.txt." << std::endl;
+            return EXIT_SUCCESS;
+        } else if (strcmp(argv[i], "--name") == 0) {
+            if (i+1 < argc) name = programName(argv[++i]);
+            else {
+                std::cerr << "--name option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--main") == 0) {
+            driver = true;
+        } else if (romPath == nullptr) {
+            romPath = argv[i];
+        } else if (outputPath == nullptr) {
+            outputPath = argv[i];
+        } else {
+            std::cerr << "Unexpected argument " << argv[i] << "." << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (romPath == nullptr || outputPath == nullptr) {
+        std::cerr << "A ROM and an output file are required." << std::endl;
+        std::cerr << "Use --help for a list of all options." << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (name.empty()) name = programName(romPath);
+
+    Rom rom;
+    rom.start = AOT_ROM_START_OFFSET;
+    std::ifstream file(romPath, std::ios::binary);
+    if (!file.good()) {
+        std::cerr << "Error! ROM file " << romPath << " does not exist!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    rom.data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    size_t const maxSize = RAM_SIZE-RESERVED_BYTES-rom.start;
+    if (rom.data.empty()) {
+        std::cerr << "Error! ROM file " << romPath << " is empty!" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (rom.data.size() > maxSize) {
+        std::cerr << "Error! ROM is too large for memory, must be at most " << maxSize << " bytes" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::map<uint16_t, size_t> starts;
+    for (uint16_t start : findBlocks(rom)) starts.emplace(start, starts.size());
+    std::ostringstream blocks;
+    std::vector<std::pair<uint16_t, uint16_t>> ranges;
+    for (auto const &entry : starts) {
+        BlockWriter writer(rom, starts, entry.first);
+        writer.write(blocks);
+        ranges.emplace_back(entry.first, writer.getEnd());
+    }
+
+    std::string const symbol = name + "Program";
+    std::ofstream out(outputPath);
+    out << "// Generated by chip-8-aot from " << romPath << ", do not edit\n";
+    out << "#include \"AotRuntime.hpp\"\n";
+    if (driver) out << "#include <chrono>\n#include <cstring>\n#include \"Chip8.hpp\"\n";
+    out << "\nextern AotProgram const " << symbol << ";\n\nnamespace {\n\nuint8_t const rom[] = {";
+    for (size_t i = 0; i < rom.data.size(); i++) {
+        out << (i % 16 == 0 ? "\n    " : " ") << hex(rom.data[i], 2) << ",";
+    }
+    out << "\n};\n\n";
+    for (auto const &[start, end] : ranges) out << "uint32_t " << function(start) << "(AotRuntime &rt, uint32_t budget);\n";
+    out << "\n" << blocks.str();
+    out << "AotBlock const blocks[] = {\n";
+    for (auto const &[start, end] : ranges) {
+        out << "    {" << hex(start, 3) << ", " << hex(end, 3) << ", " << function(start) << "},\n";
+    }
+    out << "};\n\n} // namespace\n\n";
+    out << "AotProgram const " << symbol << " = {\"" << name << "\", " << hex(rom.start, 4) << ", rom, sizeof(rom), blocks, "
+        << ranges.size() << "};\n";
+    if (driver) {
+        out << "\n";
+        writeDriver(out, symbol);
+    }
+    out.close();
+    if (!out.good()) {
+        std::cerr << "Error! Could not write " << outputPath << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::cout << romPath << ": " << ranges.size() << " blocks written to " << outputPath << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../include/Chip8.hpp"
+#include "../include/Cpu.hpp"
+
+// Standalone microbenchmarks for the interpreter's hot kernels.
+// Each benchmark is calibrated so that one repetition lasts about --min-time,
+// then run --repetitions times; the median and best ns/op are reported along
+// with the spread between them so unstable results are easy to spot.
+
+#define BENCH_ROM_START  0x200  // Where kernel programs are laid out
+#define BENCH_STORE      0xC00  // Scratch memory written by FX33/FX55
+#define BENCH_SUBROUTINE 0xE00  // Holds a single 00EE for the call/return kernel
+#define BENCH_SPRITE     0xE10  // 15 bytes of 0xFF so every sprite pixel is toggled
+
+namespace {
+
+// Keep the compiler from discarding work whose result is never read
+template <typename T>
+inline void doNotOptimize(T const &value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile T const *sink;
+    sink = &value;
+#endif
+}
+
+struct Benchmark {
+    std::string name;
+    // Runs the kernel the given number of times and returns how many operations were performed
+    std::function<uint64_t(uint64_t iterations)> run;
+};
+
+struct Options {
+    char const *filter = nullptr;
+    unsigned int repetitions = 7;
+    double minTimeMs = 50.0;
+};
+
+struct Measurement {
+    double medianNs;    // Median ns/op across repetitions
+    double bestNs;      // Fastest repetition in ns/op
+    double spread;      // (median-best)/best, a rough stability indicator
+};
+
+// Adapter around the reference interpreter. Alternative engines are compared
+// in the same binary by writing an equivalent adapter (constructible from RAM
+// and screen, with a step() that executes exactly one instruction) and
+// registering it with registerCpuBenchmarks() in main().
+class InterpreterEngine {
+    private:
+        Cpu cpu;
+
+    public:
+        static constexpr char const *name = "interpreter";
+        InterpreterEngine(std::array<uint8_t, RAM_SIZE> &ram, bool *const screen) :
+            cpu(ram, BENCH_ROM_START, 0x0050, screen) {}
+        inline void step() { cpu.clock(); }
+};
+
+template <typename Engine>
+struct Machine {
+    std::array<uint8_t, RAM_SIZE> ram{};
+    std::array<bool, SCREEN_SIZE_X*SCREEN_SIZE_Y> screen{};
+    Engine engine;
+
+    Machine() : engine(ram, screen.data()) {}
+};
+
+// A program that isolates one instruction: `setup` runs once before timing starts,
+// then every lap executes `lapHead` followed by `opcode` repeated `repeat` times
+// and a jump back to the start of the lap
+struct Kernel {
+    char const *name;
+    std::vector<uint16_t> setup;
+    std::vector<uint16_t> lapHead;
+    uint16_t opcode;
+    unsigned int repeat;
+};
+
+void writeOpcode(std::array<uint8_t, RAM_SIZE> &ram, uint16_t address, uint16_t opcode) {
+    ram[address] = opcode >> 8;
+    ram[address+1] = opcode & 0xFF;
+}
+
+template <typename Engine>
+void layoutKernel(Machine<Engine> &machine, Kernel const &kernel) {
+    uint16_t address = BENCH_ROM_START;
+    for (uint16_t opcode : kernel.setup) {
+        writeOpcode(machine.ram, address, opcode);
+        address += 2;
+    }
+    uint16_t const lapStart = address;
+    for (uint16_t opcode : kernel.lapHead) {
+        writeOpcode(machine.ram, address, opcode);
+        address += 2;
+    }
+    for (unsigned int i = 0; i < kernel.repeat; i++) {
+        writeOpcode(machine.ram, address, kernel.opcode);
+        address += 2;
+    }
+    // Two jumps so that a skip instruction landing on the second one still loops
+    writeOpcode(machine.ram, address, 0x1000 | lapStart);
+    writeOpcode(machine.ram, address+2, 0x1000 | lapStart);
+
+    writeOpcode(machine.ram, BENCH_SUBROUTINE, 0x00EE);
+    std::fill_n(machine.ram.begin()+BENCH_SPRITE, 15, 0xFF);
+
+    for (size_t i = 0; i < kernel.setup.size(); i++) machine.engine.step();
+}
+
+template <typename Engine>
+void registerCpuBenchmarks(std::vector<Benchmark> &benchmarks) {
+    std::vector<Kernel> const kernels = {
+        {"00E0 clear",              {},                         {},             0x00E0, 1024},
+        {"2NNN+00EE call/return",   {},                         {},             0x2000 | BENCH_SUBROUTINE, 1024},
+        {"1NNN jump",               {},                         {},             0x0000, 0},
+        {"3XNN skip taken",         {},                         {},             0x3000, 1024},
+        {"4XNN skip not taken",     {},                         {},             0x4000, 1024},
+        {"5XY0 skip taken",         {},                         {},             0x5010, 1024},
+        {"9XY0 skip not taken",     {},                         {},             0x9010, 1024},
+        {"6XNN load",               {},                         {},             0x6A42, 1024},
+        {"7XNN add",                {},                         {},             0x7A01, 1024},
+        {"8XY1 or",                 {0x6B0F},                   {},             0x8AB1, 1024},
+        {"8XY4 add carry",          {0x6B9F},                   {},             0x8AB4, 1024},
+        {"8XY6 shift right",        {0x6B9F},                   {},             0x8AB6, 1024},
+        {"ANNN load I",             {},                         {},             0xA123, 1024},
+        {"BNNN jump offset",        {},                         {},             0xB000 | BENCH_ROM_START, 1},
+        {"CXNN random",             {},                         {},             0xCAFF, 1024},
+        {"DXYN N=1",                {0x6000, 0x6100, 0xA000 | BENCH_SPRITE}, {}, 0xD011, 1024},
+        {"DXYN N=8",                {0x6000, 0x6100, 0xA000 | BENCH_SPRITE}, {}, 0xD018, 1024},
+        {"DXYN N=15",               {0x6000, 0x6100, 0xA000 | BENCH_SPRITE}, {}, 0xD01F, 1024},
+        {"DXYN N=8 clip right",     {0x603C, 0x6100, 0xA000 | BENCH_SPRITE}, {}, 0xD018, 1024},
+        {"DXYN N=8 clip bottom",    {0x6000, 0x611C, 0xA000 | BENCH_SPRITE}, {}, 0xD018, 1024},
+        {"DXYN N=15 clip corner",   {0x603C, 0x6118, 0xA000 | BENCH_SPRITE}, {}, 0xD01F, 1024},
+        {"DXYN N=8 wrapped origin", {0x6043, 0x6122, 0xA000 | BENCH_SPRITE}, {}, 0xD018, 1024},
+        {"EX9E key up",             {},                         {},             0xE09E, 1024},
+        {"EXA1 key up",             {},                         {},             0xE0A1, 1024},
+        {"FX07 read delay",         {},                         {},             0xF007, 1024},
+        {"FX15 set delay",          {},                         {},             0xF015, 1024},
+        {"FX1E add I",              {0x6101},                   {0xA000 | BENCH_STORE}, 0xF11E, 1024},
+        {"FX29 font address",       {},                         {},             0xF029, 1024},
+        {"FX33 BCD",                {0x63FF, 0xA000 | BENCH_STORE}, {},         0xF333, 1024},
+        {"FX55 store V0-VF",        {},                         {0xA000 | BENCH_STORE}, 0xFF55, 32},
+        {"FX65 load V0-VF",         {},                         {0xA000 | BENCH_STORE}, 0xFF65, 32},
+    };
+
+    for (Kernel const &kernel : kernels) {
+        // The machine is created on first use and then shared by calibration and all repetitions
+        std::shared_ptr<Machine<Engine>> machine;
+        benchmarks.push_back({std::string(Engine::name) + "/" + kernel.name, [kernel, machine](uint64_t iterations) mutable {
+            if (!machine) {
+                machine = std::make_shared<Machine<Engine>>();
+                layoutKernel(*machine, kernel);
+            }
+            for (uint64_t i = 0; i < iterations; i++) machine->engine.step();
+            doNotOptimize(machine->screen);
+            doNotOptimize(machine->ram);
+            return iterations;
+        }});
+    }
+}
+
+// Two screens with every pixel differing between them, so each frame
+// alternates and a diffing backend (ncurses) always has work to do
+void fillPatterns(std::array<bool, SCREEN_SIZE_X*SCREEN_SIZE_Y> &a, std::array<bool, SCREEN_SIZE_X*SCREEN_SIZE_Y> &b) {
+    for (int i = 0; i < SCREEN_SIZE_X*SCREEN_SIZE_Y; i++) {
+        int x = i % SCREEN_SIZE_X;
+        int y = i / SCREEN_SIZE_X;
+        a[i] = (x+y) % 2 == 0;
+        b[i] = !a[i];
+    }
+}
+
+void registerRenderBenchmarks(std::vector<Benchmark> &benchmarks) {
+    benchmarks.push_back({"render/sdl-points", [](uint64_t iterations) {
+        // Software renderer drawing into an offscreen surface, scaled the same way as startSDL()
+        static SDL_Surface *surface = nullptr;
+        static SDL_Renderer *renderer = nullptr;
+        static std::array<bool, SCREEN_SIZE_X*SCREEN_SIZE_Y> a, b;
+        if (renderer == nullptr) {
+            surface = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_SIZE_X*SCREEN_SCALE_FACTOR,
+                SCREEN_SIZE_Y*SCREEN_SCALE_FACTOR, 32, SDL_PIXELFORMAT_ARGB8888);
+            if (surface != nullptr) renderer = SDL_CreateSoftwareRenderer(surface);
+            if (renderer == nullptr) {
+                std::fprintf(stderr, "Error! Could not create offscreen SDL renderer: %s\n", SDL_GetError());
+                return uint64_t(0);
+            }
+            SDL_RenderSetScale(renderer, SCREEN_SCALE_FACTOR, SCREEN_SCALE_FACTOR);
+            fillPatterns(a, b);
+        }
+        for (uint64_t i = 0; i < iterations; i++) Chip8::renderSDL(renderer, (i & 1) ? b.data() : a.data());
+        return iterations;
+    }});
+
+    for (bool scanlines : {false, true}) {
+        benchmarks.push_back({scanlines ? "render/crt-compose 1920x1080 scanlines" : "render/crt-compose 1920x1080", [scanlines](uint64_t iterations) {
+            // Phosphor blend and upscale of the CRT pipeline into a 1080p buffer standing in for the texture
+            static std::array<bool, SCREEN_SIZE_X*SCREEN_SIZE_Y> a, b;
+            static std::vector<uint32_t> pixels(1920*1080);
+            Chip8Config config = {};
+            config.crtEffects = true;
+            config.phosphorDecay = 0.7f;
+            config.scanlines = scanlines;
+            static std::unique_ptr<CrtDisplay> crtDisplays[2];
+            std::unique_ptr<CrtDisplay> &crtDisplay = crtDisplays[scanlines];
+            if (!crtDisplay) {
+                crtDisplay = std::make_unique<CrtDisplay>(nullptr, config);
+                crtDisplay->resize(1920, 1080);
+                fillPatterns(a, b);
+            }
+            for (uint64_t i = 0; i < iterations; i++) crtDisplay->compose((i & 1) ? b.data() : a.data(), pixels.data(), 1920*4);
+            doNotOptimize(pixels);
+            return iterations;
+        }});
+    }
+
+    for (bool changing : {false, true}) {
+        benchmarks.push_back({changing ? "render/terminal-mvprintw changing" : "render/terminal-mvprintw static", [changing](uint64_t iterations) {
+            // ncurses writing its updates to /dev/null instead of a TTY
+            static SCREEN *term = nullptr;
+            static bool failed = false;
+            static std::array<bool, SCREEN_SIZE_X*SCREEN_SIZE_Y> a, b;
+            if (failed) return uint64_t(0);
+            if (term == nullptr) {
+                char const *termName = std::getenv("TERM");
+                // Kept open for the terminal's lifetime, which is the whole run
+                FILE *output = std::fopen("/dev/null", "w");
+                FILE *input = std::fopen("/dev/null", "r");
+                if (output != nullptr && input != nullptr) {
+                    term = newterm(termName != nullptr ? termName : "xterm", output, input);
+                    if (term == nullptr) term = newterm("vt100", output, input);
+                }
+                if (term == nullptr) {
+                    if (output != nullptr) std::fclose(output);
+                    if (input != nullptr) std::fclose(input);
+                    std::fprintf(stderr, "Error! Could not open an ncurses terminal on /dev/null\n");
+                    failed = true;
+                    return uint64_t(0);
+                }
+                resizeterm(SCREEN_SIZE_Y, SCREEN_SIZE_X*2);
+                fillPatterns(a, b);
+            }
+            for (uint64_t i = 0; i < iterations; i++) Chip8::renderTerminal((changing && (i & 1)) ? b.data() : a.data());
+            return iterations;
+        }});
+    }
+}
+
+// Returns elapsed nanoseconds per operation, or a negative value if the benchmark did nothing
+double timeOnce(Benchmark const &benchmark, uint64_t iterations) {
+    auto const start = std::chrono::steady_clock::now();
+    uint64_t ops = benchmark.run(iterations);
+    auto const end = std::chrono::steady_clock::now();
+    if (ops == 0) return -1.0;
+    return std::chrono::duration<double, std::nano>(end-start).count()/ops;
+}
+
+bool measure(Benchmark const &benchmark, Options const &options, Measurement &result) {
+    // Grow the iteration count until one repetition takes about --min-time
+    double const targetNs = options.minTimeMs*1e6;
+    uint64_t iterations = 1;
+    while (true) {
+        double nsPerOp = timeOnce(benchmark, iterations);
+        if (nsPerOp < 0) return false;
+        double totalNs = nsPerOp*iterations;
+        if (totalNs >= targetNs/10 || iterations >= (uint64_t(1) << 40)) {
+            iterations = std::max<uint64_t>(1, uint64_t(iterations*targetNs/std::max(totalNs, 1.0)));
+            break;
+        }
+        iterations *= 10;
+    }
+
+    timeOnce(benchmark, iterations); // Warm-up
+    std::vector<double> samples;
+    for (unsigned int i = 0; i < options.repetitions; i++) samples.push_back(timeOnce(benchmark, iterations));
+    std::sort(samples.begin(), samples.end());
+    result.medianNs = samples[samples.size()/2];
+    result.bestNs = samples.front();
+    result.spread = (result.medianNs-result.bestNs)/result.bestNs;
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options;
+    bool listOnly = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0) {
+            std::printf("Usage: chip-8-bench [OPTIONS]\n\nwith options:\n"
+                "-l, --list\nList benchmark names and exit.\n"
+                "--filter TEXT\nOnly run benchmarks whose name contains TEXT.\n"
+                "--repetitions VALUE\nNumber of timed repetitions per benchmark. Default is 7.\n"
+                "--min-time VALUE\nApproximate duration of one repetition in milliseconds. Default is 50.\n");
+            return EXIT_SUCCESS;
+        } else if (std::strcmp(argv[i], "-l") == 0 || std::strcmp(argv[i], "--list") == 0) {
+            listOnly = true;
+        } else if (std::strcmp(argv[i], "--filter") == 0 && i+1 < argc) {
+            options.filter = argv[++i];
+        } else if (std::strcmp(argv[i], "--repetitions") == 0 && i+1 < argc) {
+            int r = std::atoi(argv[++i]);
+            if (r <= 0) {
+                std::fprintf(stderr, "--repetitions option must be a positive number.\n");
+                return EXIT_FAILURE;
+            }
+            options.repetitions = r;
+        } else if (std::strcmp(argv[i], "--min-time") == 0 && i+1 < argc) {
+            double t = std::atof(argv[++i]);
+            if (t <= 0) {
+                std::fprintf(stderr, "--min-time option must be a positive number.\n");
+                return EXIT_FAILURE;
+            }
+            options.minTimeMs = t;
+        } else {
+            std::fprintf(stderr, "Unknown option %s. Use --help for a list of all options.\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<Benchmark> benchmarks;
+    registerCpuBenchmarks<InterpreterEngine>(benchmarks);
+    registerRenderBenchmarks(benchmarks);
+
+    if (!listOnly) std::printf("%-45s %12s %12s %8s\n", "benchmark", "median ns/op", "best ns/op", "spread");
+    for (Benchmark const &benchmark : benchmarks) {
+        if (options.filter != nullptr && benchmark.name.find(options.filter) == std::string::npos) continue;
+        if (listOnly) {
+            std::printf("%s\n", benchmark.name.c_str());
+            continue;
+        }
+        Measurement m;
+        if (!measure(benchmark, options, m)) {
+            std::printf("%-45s %12s\n", benchmark.name.c_str(), "skipped");
+            continue;
+        }
+        std::printf("%-45s %12.2f %12.2f %7.1f%%\n", benchmark.name.c_str(), m.medianNs, m.bestNs, m.spread*100);
+        std::fflush(stdout);
+    }
+    return EXIT_SUCCESS;
+}
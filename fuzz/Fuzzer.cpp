@@ -0,0 +1,481 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include "../include/AotRuntime.hpp"
+#include "../include/Cpu.hpp"
+#include "../include/Debugger.hpp"
+#include "../include/StateDump.hpp"
+
+// Differential fuzzer: runs the same ROM, random seed and key input through the
+// reference interpreter (Cpu::clock()) and another engine side by side, comparing
+// the whole machine state every few instructions. Failing cases are shrunk and saved.
+// Built as a standalone executable, or as a libFuzzer target with -DCHIP8_LIBFUZZER=ON.
+//
+// A case is (little-endian):
+//   uint32 seed, uint8 flags, uint16 romSize, romSize bytes of ROM loaded at FUZZ_ROM_START,
+//   then one byte per event: bits 6-7 are the number of comparison intervals to run first minus 1,
+//   bits 4-5 the action (0 none, 1 press, 2 release, 3 timer tick) and bits 0-3 the key.
+// Engines running a program compiled by chip-8-aot ignore the ROM and run the one they were compiled from.
+
+#define FUZZ_ROM_START 0x200
+#define FUZZ_FONT_START 0x050
+#define FUZZ_HEADER_SIZE 7
+#define FUZZ_MAX_ROM_SIZE (RAM_SIZE-RESERVED_BYTES-FUZZ_ROM_START)
+#define FUZZ_FLAG_AUTO_RELEASE 0x1      // Release keys once an instruction sees them, as in terminal mode
+#define FUZZ_STATE_SIZE 128             // Binary dump without RAM and screen
+#define FUZZ_MAX_SHRINK_RUNS 5000       // Gives up shrinking after this many attempts
+#define FUZZ_CORPUS_INSTRUCTIONS 1024   // Size of the ROM written by --write-rom
+
+#ifdef CHIP8_FUZZ_AOT
+extern AotProgram const tetrisProgram;
+extern AotProgram const brixProgram;
+extern AotProgram const corpusProgram;
+#endif
+
+namespace {
+
+struct FuzzCase {
+    uint32_t seed = 0;
+    uint8_t flags = 0;
+    std::vector<uint8_t> rom;
+    std::vector<uint8_t> events;
+};
+
+FuzzCase parseCase(uint8_t const *data, size_t size) {
+    FuzzCase fuzzCase;
+    uint8_t header[FUZZ_HEADER_SIZE] = {0};
+    std::memcpy(header, data, std::min<size_t>(size, FUZZ_HEADER_SIZE));
+    fuzzCase.seed = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+    fuzzCase.flags = header[4];
+    size_t const offset = std::min<size_t>(size, FUZZ_HEADER_SIZE);
+    size_t const romSize = std::min<size_t>({(size_t)(header[5] | header[6] << 8), size-offset, FUZZ_MAX_ROM_SIZE});
+    fuzzCase.rom.assign(data+offset, data+offset+romSize);
+    fuzzCase.events.assign(data+offset+romSize, data+size);
+    return fuzzCase;
+}
+std::vector<uint8_t> serializeCase(FuzzCase const &fuzzCase) {
+    std::vector<uint8_t> data = {
+        (uint8_t)fuzzCase.seed, (uint8_t)(fuzzCase.seed >> 8), (uint8_t)(fuzzCase.seed >> 16), (uint8_t)(fuzzCase.seed >> 24),
+        fuzzCase.flags, (uint8_t)fuzzCase.rom.size(), (uint8_t)(fuzzCase.rom.size() >> 8)
+    };
+    data.insert(data.end(), fuzzCase.rom.begin(), fuzzCase.rom.end());
+    data.insert(data.end(), fuzzCase.events.begin(), fuzzCase.events.end());
+    return data;
+}
+
+struct Machine {
+    std::array<uint8_t, RAM_SIZE> ram{};
+    std::array<bool, SCREEN_SIZE_X*SCREEN_SIZE_Y> screen{};
+    Cpu cpu;
+
+    Machine(FuzzCase const &fuzzCase, uint8_t const *rom, size_t romSize) : cpu(ram, FUZZ_ROM_START, FUZZ_FONT_START, screen.data()) {
+        std::copy_n(rom, romSize, ram.begin()+FUZZ_ROM_START);
+        cpu.seedRandom(fuzzCase.seed);
+        cpu.setAutoReleaseKey(fuzzCase.flags & FUZZ_FLAG_AUTO_RELEASE);
+    }
+    Machine(Machine const &machine) = delete;
+};
+
+// Adapters around the engines under test, each executing exactly the given number of instructions
+class Engine {
+    public:
+        virtual ~Engine() {}
+        virtual void run(uint64_t instructions) = 0;
+};
+class InterpreterEngine : public Engine {
+    private:
+        Cpu &cpu;
+
+    public:
+        InterpreterEngine(Machine &machine) : cpu(machine.cpu) {}
+        void run(uint64_t instructions) override {
+            for (uint64_t i = 0; i < instructions; i++) cpu.clock();
+        }
+};
+// The Debugger instantiation of Cpu::clock(), running freely
+class DebuggerEngine : public Engine {
+    private:
+        Cpu &cpu;
+        Debugger debugger;
+
+    public:
+        DebuggerEngine(Machine &machine) : cpu(machine.cpu), debugger(machine.cpu, machine.ram, true) {
+            debugger.execute("c");
+        }
+        void run(uint64_t instructions) override {
+            for (uint64_t i = 0; i < instructions; i++) {
+                if (debugger.shouldBreak()) continue;
+                cpu.clock(debugger);
+                debugger.afterInstruction();
+            }
+        }
+};
+class AotEngine : public Engine {
+    private:
+        AotRuntime runtime;
+
+    public:
+        AotEngine(Machine &machine, AotProgram const &program) : runtime(machine.cpu, program) {}
+        void run(uint64_t instructions) override { runtime.run(instructions); }
+};
+
+struct EngineInfo {
+    char const *name;
+    char const *description;
+    AotProgram const *program;          // Set for engines running a compiled program instead of the case's ROM
+};
+EngineInfo const engines[] = {
+    {"debugger", "Cpu::clock() instantiated for the Debugger, without breakpoints", nullptr},
+#ifdef CHIP8_FUZZ_AOT
+    {"tetris", "TETRIS compiled by chip-8-aot, driven by the case's input", &tetrisProgram},
+    {"brix", "BRIX compiled by chip-8-aot, driven by the case's input", &brixProgram},
+    {"corpus", "fuzz/corpus.ch8 compiled by chip-8-aot, driven by the case's input", &corpusProgram},
+#endif
+};
+
+EngineInfo const *findEngine(char const *name) {
+    for (EngineInfo const &engine : engines) {
+        if (std::strcmp(engine.name, name) == 0) return &engine;
+    }
+    return nullptr;
+}
+std::unique_ptr<Engine> createEngine(EngineInfo const &engine, Machine &machine) {
+    if (engine.program != nullptr) return std::make_unique<AotEngine>(machine, *engine.program);
+    return std::make_unique<DebuggerEngine>(machine);
+}
+
+struct Options {
+    EngineInfo const *engine = &engines[0];
+    unsigned int compareEvery = 8;
+    uint64_t maxInstructions = 10000;
+};
+
+bool sameState(Machine const &expected, Machine const &actual) {
+    char left[FUZZ_STATE_SIZE], right[FUZZ_STATE_SIZE];
+    size_t const leftSize = dumpState(expected.cpu, expected.ram, expected.screen.data(), 0, DumpFormat::Binary, 0, left, sizeof(left));
+    size_t const rightSize = dumpState(actual.cpu, actual.ram, actual.screen.data(), 0, DumpFormat::Binary, 0, right, sizeof(right));
+    return leftSize == rightSize && std::memcmp(left, right, leftSize) == 0
+        && expected.ram == actual.ram && expected.screen == actual.screen;
+}
+std::string describeMismatch(Machine const &expected, Machine const &actual, uint64_t instructions) {
+    std::string text = "State differs after " + std::to_string(instructions) + " instructions\n";
+    std::vector<char> buffer(STATE_DUMP_MAX_SIZE);
+    size_t size = dumpState(expected.cpu, expected.ram, expected.screen.data(), instructions, DumpFormat::Json, 0, buffer.data(), buffer.size());
+    text += "  interpreter: " + std::string(buffer.data(), size);
+    size = dumpState(actual.cpu, actual.ram, actual.screen.data(), instructions, DumpFormat::Json, 0, buffer.data(), buffer.size());
+    text += "  engine:      " + std::string(buffer.data(), size);
+    for (int i = 0; i < RAM_SIZE; i++) {
+        if (expected.ram[i] == actual.ram[i]) continue;
+        text += "  first RAM difference at " + stringHex(i, 3).str() + ": " + stringHex(expected.ram[i], 2).str()
+            + " vs " + stringHex(actual.ram[i], 2).str() + "\n";
+        break;
+    }
+    for (int i = 0; i < SCREEN_SIZE_X*SCREEN_SIZE_Y; i++) {
+        if (expected.screen[i] == actual.screen[i]) continue;
+        text += "  first pixel difference at (" + std::to_string(i % SCREEN_SIZE_X) + ", " + std::to_string(i / SCREEN_SIZE_X) + ")\n";
+        break;
+    }
+    return text;
+}
+
+struct Failure {
+    uint64_t instructions;              // Instructions run when the difference was noticed
+    std::string description;
+};
+
+// Run the case through both engines, comparing the state every `step` instructions.
+// Events are applied every options.compareEvery instructions whatever the step, so
+// the same case can be replayed with step 1 to find the first instruction that differs
+std::optional<Failure> runCase(FuzzCase const &fuzzCase, Options const &options, unsigned int step) {
+    uint8_t const *rom = fuzzCase.rom.data();
+    size_t romSize = fuzzCase.rom.size();
+    if (options.engine->program != nullptr) {
+        rom = options.engine->program->rom;
+        romSize = options.engine->program->romSize;
+    }
+    Machine expected(fuzzCase, rom, romSize);
+    Machine actual(fuzzCase, rom, romSize);
+    InterpreterEngine reference(expected);
+    std::unique_ptr<Engine> engine = createEngine(*options.engine, actual);
+
+    // Stack errors are expected from random programs, keep them off the terminal
+    std::cerr.setstate(std::ios::badbit);
+    std::optional<Failure> failure;
+    uint64_t instructions = 0;
+    size_t event = 0;
+    while (!failure && instructions < options.maxInstructions) {
+        // Keep running without input once the events are used up
+        uint8_t const value = event < fuzzCase.events.size() ? fuzzCase.events[event++] : 0;
+        for (unsigned int interval = 0; interval <= (value >> 6) && !failure; interval++) {
+            for (unsigned int done = 0; done < options.compareEvery && !failure; done += step) {
+                uint64_t const count = std::min<uint64_t>(step, options.compareEvery-done);
+                reference.run(count);
+                engine->run(count);
+                instructions += count;
+                if (!sameState(expected, actual)) failure = Failure{instructions, describeMismatch(expected, actual, instructions)};
+            }
+        }
+        uint8_t const key = value & 0xF;
+        switch ((value >> 4) & 0x3) {
+            case 1: expected.cpu.pressKey(key); actual.cpu.pressKey(key); break;
+            case 2: expected.cpu.releaseKey(key); actual.cpu.releaseKey(key); break;
+            case 3: expected.cpu.updateTimers(); actual.cpu.updateTimers(); break;
+            default: break;
+        }
+    }
+    std::cerr.clear();
+    return failure;
+}
+
+// Remove chunks of `items` (halving the chunk size down to `unit`) as long as the case keeps failing
+void shrinkSequence(FuzzCase &fuzzCase, std::vector<uint8_t> FuzzCase::*items, size_t unit,
+    Options const &options, unsigned int &runs) {
+    size_t chunk = std::max(unit, (fuzzCase.*items).size()/2/unit*unit);
+    while (true) {
+        for (size_t start = 0; start < (fuzzCase.*items).size() && runs < FUZZ_MAX_SHRINK_RUNS;) {
+            FuzzCase candidate = fuzzCase;
+            std::vector<uint8_t> &sequence = candidate.*items;
+            sequence.erase(sequence.begin()+start, sequence.begin()+std::min(start+chunk, sequence.size()));
+            runs++;
+            if (runCase(candidate, options, options.compareEvery)) fuzzCase = std::move(candidate);
+            else start += chunk;
+        }
+        if (chunk == unit) break;
+        chunk = std::max(unit, chunk/2/unit*unit);
+    }
+}
+// Blank out instructions that are not needed to fail, keeping the others at their addresses
+void shrinkRom(FuzzCase &fuzzCase, Options const &options, unsigned int &runs) {
+    for (size_t i = 0; i+1 < fuzzCase.rom.size() && runs < FUZZ_MAX_SHRINK_RUNS; i += 2) {
+        if (fuzzCase.rom[i] == 0 && fuzzCase.rom[i+1] == 0) continue;
+        FuzzCase candidate = fuzzCase;
+        candidate.rom[i] = candidate.rom[i+1] = 0;  // 0NNN does nothing
+        runs++;
+        if (runCase(candidate, options, options.compareEvery)) fuzzCase = std::move(candidate);
+    }
+    while (!fuzzCase.rom.empty() && fuzzCase.rom.back() == 0) fuzzCase.rom.pop_back();
+}
+FuzzCase shrinkCase(FuzzCase fuzzCase, Options const &options) {
+    unsigned int runs = 0;
+    shrinkSequence(fuzzCase, &FuzzCase::events, 1, options, runs);
+    if (options.engine->program == nullptr) {
+        shrinkSequence(fuzzCase, &FuzzCase::rom, 2, options, runs);
+        shrinkRom(fuzzCase, options, runs);
+    }
+    return fuzzCase;
+}
+
+void printCase(FuzzCase const &fuzzCase, Options const &options) {
+    std::printf("seed %08X, flags %02X, %zu events\n", fuzzCase.seed, fuzzCase.flags, fuzzCase.events.size());
+    if (options.engine->program != nullptr) return;
+    for (size_t i = 0; i+1 < fuzzCase.rom.size(); i += 2) {
+        uint16_t const opcode = fuzzCase.rom[i] << 8 | fuzzCase.rom[i+1];
+        if (opcode != 0) std::printf("  %03zX: %04X  %s\n", FUZZ_ROM_START+i, opcode, disassemble(opcode).c_str());
+    }
+}
+
+// Report a failing case with the first instruction that differs, shrink it and save it
+void reportFailure(FuzzCase const &fuzzCase, Failure const &failure, Options const &options, char const *outputPath) {
+    std::printf("%s", failure.description.c_str());
+    FuzzCase const shrunk = shrinkCase(fuzzCase, options);
+    std::printf("\nShrunk case (%s engine):\n", options.engine->name);
+    printCase(shrunk, options);
+    // Comparing after every instruction finds the first one that differs, unless the engine
+    // only goes wrong when it runs several instructions at once
+    std::optional<Failure> exact = runCase(shrunk, options, 1);
+    if (!exact) exact = runCase(shrunk, options, options.compareEvery);
+    if (exact) std::printf("%s", exact->description.c_str());
+    std::vector<uint8_t> const data = serializeCase(shrunk);
+    std::ofstream file(outputPath, std::ios::binary);
+    file.write(reinterpret_cast<char const *>(data.data()), data.size());
+    if (file.good()) std::printf("Saved to %s\n", outputPath);
+    else std::fprintf(stderr, "Error! Could not write %s\n", outputPath);
+}
+
+inline uint32_t nextRandom(uint32_t &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+// Random programs biased towards opcodes that exist, so that most of a ROM does something
+uint16_t randomOpcode(uint32_t &state) {
+    auto next = [&state]() { return nextRandom(state); };
+    uint16_t const opcode = next() & 0xFFFF;
+    if (next() % 4 == 0) return opcode;
+    static uint8_t const fSubOpcodes[] = {0x07, 0x0A, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65};
+    switch (opcode >> 12) {
+        case 0x0: return next() % 2 ? 0x00E0 : 0x00EE;
+        case 0x1: case 0x2: case 0xA: case 0xB:
+            // Keep jumps, calls and I mostly inside the program
+            return (opcode & 0xF000) | (next() % 4 ? FUZZ_ROM_START+(opcode & 0xFE) : (opcode & 0x0FFF));
+        case 0x5: case 0x9: return opcode & 0xFFF0;
+        case 0x8: {
+            uint8_t const op = next() % 9;
+            return (opcode & 0xFFF0) | (op == 8 ? 0xE : op);
+        }
+        case 0xE: return (opcode & 0xFF00) | (next() % 2 ? 0x9E : 0xA1);
+        case 0xF: return (opcode & 0xFF00) | fSubOpcodes[next() % sizeof(fSubOpcodes)];
+        default: return opcode;
+    }
+}
+std::vector<uint8_t> randomRom(uint32_t &state, size_t instructions) {
+    std::vector<uint8_t> rom;
+    for (size_t i = 0; i < instructions; i++) {
+        uint16_t const opcode = randomOpcode(state);
+        rom.push_back(opcode >> 8);
+        rom.push_back(opcode & 0xFF);
+    }
+    return rom;
+}
+FuzzCase randomCase(uint32_t &state, Options const &options) {
+    FuzzCase fuzzCase;
+    fuzzCase.seed = nextRandom(state);
+    fuzzCase.flags = nextRandom(state) & FUZZ_FLAG_AUTO_RELEASE;
+    if (options.engine->program == nullptr) fuzzCase.rom = randomRom(state, 1+nextRandom(state) % 128);
+    size_t const events = nextRandom(state) % 512;
+    for (size_t i = 0; i < events; i++) fuzzCase.events.push_back(nextRandom(state) & 0xFF);
+    return fuzzCase;
+}
+
+Options libFuzzerOptions() {
+    Options options;
+    if (char const *name = std::getenv("CHIP8_FUZZ_ENGINE")) {
+        if (EngineInfo const *engine = findEngine(name)) options.engine = engine;
+        else std::fprintf(stderr, "Unknown engine %s in CHIP8_FUZZ_ENGINE, using %s.\n", name, options.engine->name);
+    }
+    return options;
+}
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const *data, size_t size) {
+    static Options const options = libFuzzerOptions();
+    FuzzCase const fuzzCase = parseCase(data, size);
+    std::optional<Failure> failure = runCase(fuzzCase, options, options.compareEvery);
+    if (failure) {
+        std::fprintf(stderr, "%s", failure->description.c_str());
+        std::abort();
+    }
+    return 0;
+}
+
+#ifndef CHIP8_LIBFUZZER
+int main(int argc, char *argv[]) {
+    Options options;
+    uint64_t runs = 10000;
+    uint32_t seed = time(0);
+    char const *outputPath = "fuzz-failure.bin";
+    char const *romPath = nullptr;
+    std::vector<char const *> casePaths;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "-h") == 0 || std::strcmp(argv[i], "--help") == 0) {
+            std::printf("Usage: chip-8-fuzz [OPTIONS] [CASE FILE...]\n\n"
+                "Run random cases, or the given case files, through the interpreter and another engine and compare them.\n\nwith options:\n"
+                "-l, --list\nList engines and exit.\n"
+                "--engine NAME\nEngine to check against the interpreter. Default is %s.\n"
+                "--runs VALUE\nNumber of random cases to run, 0 for no limit. Default is 10000.\n"
+                "--seed VALUE\nSeed for generating random cases. Default is the current time.\n"
+                "--compare-every VALUE\nInstructions between state comparisons and input events. Default is 8.\n"
+                "--max-instructions VALUE\nInstructions to run per case. Default is 10000.\n"
+                "--output PATH\nWhere to save the shrunk failing case. Default is fuzz-failure.bin.\n"
+                "--write-rom PATH\nWrite a random ROM generated from the seed to PATH and exit, as done for fuzz/corpus.ch8.\n", engines[0].name);
+            return EXIT_SUCCESS;
+        } else if (std::strcmp(argv[i], "-l") == 0 || std::strcmp(argv[i], "--list") == 0) {
+            for (EngineInfo const &engine : engines) std::printf("%-10s %s\n", engine.name, engine.description);
+            return EXIT_SUCCESS;
+        } else if (std::strcmp(argv[i], "--engine") == 0 && i+1 < argc) {
+            options.engine = findEngine(argv[++i]);
+            if (options.engine == nullptr) {
+                std::fprintf(stderr, "Unknown engine %s. Use --list for a list of all engines.\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--runs") == 0 && i+1 < argc) {
+            runs = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--seed") == 0 && i+1 < argc) {
+            seed = std::strtoul(argv[++i], nullptr, 0);
+        } else if (std::strcmp(argv[i], "--compare-every") == 0 && i+1 < argc) {
+            int n = std::atoi(argv[++i]);
+            if (n <= 0) {
+                std::fprintf(stderr, "--compare-every option must be a positive number.\n");
+                return EXIT_FAILURE;
+            }
+            options.compareEvery = n;
+        } else if (std::strcmp(argv[i], "--max-instructions") == 0 && i+1 < argc) {
+            long long n = std::atoll(argv[++i]);
+            if (n <= 0) {
+                std::fprintf(stderr, "--max-instructions option must be a positive number.\n");
+                return EXIT_FAILURE;
+            }
+            options.maxInstructions = n;
+        } else if (std::strcmp(argv[i], "--output") == 0 && i+1 < argc) {
+            outputPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--write-rom") == 0 && i+1 < argc) {
+            romPath = argv[++i];
+        } else if (argv[i][0] == '-') {
+            std::fprintf(stderr, "Unknown option %s. Use --help for a list of all options.\n", argv[i]);
+            return EXIT_FAILURE;
+        } else {
+            casePaths.push_back(argv[i]);
+        }
+    }
+
+    if (romPath != nullptr) {
+        uint32_t state = seed != 0 ? seed : 1;
+        std::vector<uint8_t> const rom = randomRom(state, FUZZ_CORPUS_INSTRUCTIONS);
+        std::ofstream file(romPath, std::ios::binary);
+        file.write(reinterpret_cast<char const *>(rom.data()), rom.size());
+        if (!file.good()) {
+            std::fprintf(stderr, "Error! Could not write %s\n", romPath);
+            return EXIT_FAILURE;
+        }
+        std::printf("Saved a %zu byte ROM generated with seed %u to %s\n", rom.size(), seed, romPath);
+        return EXIT_SUCCESS;
+    }
+
+    if (!casePaths.empty()) {
+        for (char const *path : casePaths) {
+            std::ifstream file(path, std::ios::binary);
+            if (!file.good()) {
+                std::fprintf(stderr, "Error! Case file %s does not exist!\n", path);
+                return EXIT_FAILURE;
+            }
+            std::vector<uint8_t> const data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            FuzzCase const fuzzCase = parseCase(data.data(), data.size());
+            if (std::optional<Failure> failure = runCase(fuzzCase, options, options.compareEvery)) {
+                std::printf("%s: ", path);
+                reportFailure(fuzzCase, *failure, options, outputPath);
+                return EXIT_FAILURE;
+            }
+            std::printf("%s: OK\n", path);
+        }
+        return EXIT_SUCCESS;
+    }
+
+    std::printf("Fuzzing the %s engine with seed %u\n", options.engine->name, seed);
+    uint32_t state = seed != 0 ? seed : 1;
+    for (uint64_t run = 0; runs == 0 || run < runs; run++) {
+        FuzzCase const fuzzCase = randomCase(state, options);
+        if (std::optional<Failure> failure = runCase(fuzzCase, options, options.compareEvery)) {
+            std::printf("Case %llu: ", (unsigned long long)run);
+            reportFailure(fuzzCase, *failure, options, outputPath);
+            return EXIT_FAILURE;
+        }
+        if ((run+1) % 1000 == 0) {
+            std::printf("%llu cases OK\n", (unsigned long long)run+1);
+            std::fflush(stdout);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,113 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "../include/Chip8Config.hpp"
+#include "../include/Cpu.hpp"
+
+#define AOT_MAX_BLOCK_INSTRUCTIONS 64       // Longest block chip-8-aot compiles into one function
+#define AOT_MAX_CHAIN_INSTRUCTIONS 4096     // Most instructions run by chained blocks before returning to
+                                            // the dispatcher, bounds the stack in unoptimized builds
+
+class AotRuntime;
+
+// Native code for the instructions starting at one address, generated by chip-8-aot.
+// Runs at least one and at most `budget` instructions, continuing into the next
+// block when it is known, leaves the program counter at the next instruction to
+// run and returns the budget left
+typedef uint32_t (*AotBlockFunction)(AotRuntime &runtime, uint32_t budget);
+
+struct AotBlock {
+    uint16_t start;                     // Address of the first instruction
+    uint16_t end;                       // One past the last ROM byte the block was compiled from
+    AotBlockFunction function;
+};
+
+// Everything chip-8-aot generates for one ROM
+struct AotProgram {
+    char const *name;
+    uint16_t romStartOffset;
+    uint8_t const *rom;                 // ROM image the blocks were compiled from
+    size_t romSize;
+    AotBlock const *blocks;
+    size_t blockCount;
+};
+
+// Runs a Cpu through a program compiled by chip-8-aot, with the same results as
+// calling Cpu::clock() the same number of times. Addresses without a compiled
+// block (computed BNNN targets the recompiler did not find, FX0A, code outside
+// the ROM) and blocks whose bytes were overwritten by the program itself are
+// run by the interpreter instead.
+class AotRuntime {
+    private:
+        Cpu &cpu;
+        AotProgram const &program;
+        std::array<int32_t, RAM_SIZE> entries;  // Index of the block starting at each address, -1 if none
+        std::vector<bool> invalid;              // Blocks whose ROM bytes have been overwritten
+        std::array<bool, RAM_SIZE> compiled;    // Bytes at least one block was compiled from
+
+        // Disable every block compiled from the given address
+        void invalidate(uint16_t address);
+
+    public:
+        // Machine state used by the generated code
+        std::array<uint8_t, 16> &V;
+        uint16_t &I;
+        uint16_t &pc;
+        uint8_t &delayTimer;
+        uint8_t &soundTimer;
+        uint16_t const fontStartOffset;
+        bool codeModified;                      // Set when a store hits compiled code, the running block must return
+
+        AotRuntime(Cpu &cpu, AotProgram const &program);
+        // Same program and disabled blocks as the runtime, running the given Cpu
+        AotRuntime(Cpu &cpu, AotRuntime const &runtime);
+        AotRuntime(AotRuntime const &runtime) = delete;
+        ~AotRuntime();
+        AotProgram const &getProgram() const { return program; };
+        // Whether the block with the given index may still run
+        inline bool isValid(size_t index) const { return !invalid[index]; };
+
+        // Whether the ROM in the given RAM is the one the program was compiled from
+        bool matches(std::array<uint8_t, RAM_SIZE> const &ram) const;
+        // Execute the given number of instructions
+        void run(uint64_t instructions);
+
+        // Observer hooks, see Cpu::clock(Observer &)
+        static constexpr bool enabled = true;
+        inline void onRead(uint16_t) {}
+        inline void onWrite(uint16_t address) {
+            if (compiled[address]) invalidate(address);   // Cpu masks every address it reports
+        }
+
+        // Helpers for the generated code
+        // Run DXYN, FX33, FX55 or FX65 through the interpreter's handler
+        void execute(uint16_t opcode);
+        void clearScreen();
+        inline uint8_t random(uint8_t mask) { return cpu.random() & mask; };
+        // 2NNN: returns false on stack overflow, leaving the program counter at the return address
+        inline bool call(uint16_t returnAddress, uint16_t address) {
+            pc = returnAddress;
+            if (!cpu.stackPush(pc)) return false;
+            pc = address;
+            return true;
+        }
+        // 00EE: leaves the program counter unchanged on stack underflow
+        inline void ret() {
+            std::optional<uint16_t> popVal = cpu.stackPop();
+            if (popVal) pc = popVal.value();
+        }
+        // EX9E: whether to skip the next instruction
+        inline bool skipIfPressed(uint8_t key) {
+            if (key > 0xF || !cpu.keys[key]) return false;
+            if (cpu.autoReleaseKey) cpu.releaseKey(key);
+            return true;
+        }
+        // EXA1: whether to skip the next instruction
+        inline bool skipIfNotPressed(uint8_t key) {
+            if (key > 0xF) return false;
+            if (!cpu.keys[key]) return true;
+            if (cpu.autoReleaseKey) cpu.releaseKey(key);
+            return false;
+        }
+};
@@ -2,13 +2,23 @@
 #include <array>
 #include <cstdint>
 #include <fstream>
+#include <memory>
 #include <curses.h>
 #include <chrono>
+#include <optional>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_stdinc.h>
 #include <SDL2/SDL_video.h>
+#include "../include/AotRuntime.hpp"
 #include "../include/Chip8Config.hpp"
 #include "../include/Cpu.hpp"
+#include "../include/CrtDisplay.hpp"
+#include "../include/Debugger.hpp"
+#include "../include/Metrics.hpp"
+#include "../include/Recorder.hpp"
+#include "../include/Scheduling.hpp"
+#include "../include/SharedState.hpp"
+#include "../include/StateDump.hpp"
 #include "../include/Utils.hpp"
 
 class Chip8 {
@@ -41,6 +51,17 @@ class Chip8 {
 
         Cpu cpu;
 
+        uint64_t frameCount;                                    // Number of frames displayed so far
+        float frameClockAccumulator;                            // Instructions owed to the next runFrame()
+        float frameTimerAccumulator;                            // Timer updates owed to the next runFrame()
+        Metrics metrics;                                        // Frame pacing of the interactive frontends, always recorded
+        std::unique_ptr<SharedState> sharedState;               // Set when exporting state to shared memory
+        std::unique_ptr<StateDumper> stateDumper;               // Set when dumping state every few frames
+        std::unique_ptr<Recorder> recorder;                     // Set when recording frames to a file
+        std::unique_ptr<Debugger> debugger;                     // Set in debug mode
+        std::unique_ptr<AotRuntime> aotRuntime;                 // Set when running code compiled by chip-8-aot
+        std::optional<SchedulingOptions> scheduling;            // Applied to the thread running the main loop
+
         // Input mappings hard-coded as:
         //  Keypad               Keyboard
         // ╔═══╦═══╦═══╦═══╗    ╔═══╦═══╦═══╦═══╗
@@ -57,6 +78,16 @@ class Chip8 {
         void handleNcursesInput();
         void startSDL();
         void startTerminal();
+        // Called after every displayed frame by both frontends
+        void endFrame();
+        // Record a presented frame and, if requested, return the new status line
+        char const *presentFrame(char *status);
+        // Execute one instruction, through the debugger if there is one
+        void clockCpu();
+        // Decrement the timers at 60 Hz unless the debugger has paused execution
+        void updateTimers();
+        // Apply the scheduling options, if any, to the calling thread once the frontend is set up
+        void applySchedulingOptions();
 
     public:
         Chip8(Chip8Config const config);
@@ -68,5 +99,37 @@ class Chip8 {
         bool loadFont(char const *const fontPath);
         // Load ROM file into Chip-8 RAM given a path
         bool loadRom (char const *const romPath);
+        // Load ROM data already in memory into Chip-8 RAM
+        bool loadRom (uint8_t const *const data, size_t size);
+        // Publish the framebuffer and registers to a POSIX shared-memory segment every frame
+        // and accept key input from it, see SharedState.hpp for the layout
+        bool exportSharedState(char const *const name);
+        // Append a state dump (see StateDump.hpp) to the file at the path, or standard error if null, every `frames` frames
+        bool dumpStateEvery(uint64_t frames, char const *const path, DumpFormat format, uint8_t sections);
+        // Write the current state into the buffer without allocating, returns the bytes written or 0 if it is too small
+        size_t dumpState(char *buffer, size_t size, DumpFormat format, uint8_t sections) const;
+        // Stream every frame to a video file, with each pixel scaled up to scale x scale pixels
+        bool record(char const *const path, RecordFormat format, unsigned int scale);
+        // Pin, prioritize and lock the emulation loop when start() or runHeadless() runs it
+        void setScheduling(SchedulingOptions const &options) { scheduling = options; };
+        // Run runFrame() through code compiled by chip-8-aot from the loaded ROM
+        bool useAotProgram(AotProgram const &program);
         void start();
+        // Run one frame (clockSpeed/refreshRate instructions and the matching timer updates)
+        // without any frontend, for headless sessions
+        void runFrame();
+        // Run the given number of frames (0 for no limit) as fast as possible without any frontend,
+        // stopping early on SIGINT or SIGTERM
+        void runHeadless(uint64_t frames);
+        void pressKey(uint8_t key) { cpu.pressKey(key); };
+        void releaseKey(uint8_t key) { cpu.releaseKey(key); };
+        void seedRandom(uint32_t seed) { cpu.seedRandom(seed); };
+        std::array<bool, SCREEN_SIZE_X*SCREEN_SIZE_Y> const &getScreen() const { return screen; };
+        uint64_t getFrameCount() const { return frameCount; };
+        Metrics const &getMetrics() const { return metrics; };
+
+        // Draw a frame of the given screen with the (already scaled) renderer and present it
+        static void renderSDL(SDL_Renderer *renderer, bool const *const screen);
+        // Draw a frame of the given screen to the current ncurses terminal and refresh it
+        static void renderTerminal(bool const *const screen);
 };
@@ -2,6 +2,7 @@
 #include <cstdint>
 
 #define RAM_SIZE 4096           // Size of CHIP-8 memory in bytes
+#define RAM_ADDRESS_MASK (RAM_SIZE-1)   // Addresses past the end of memory wrap around to its start
 #define RESERVED_BYTES 352      // The number of bytes at the end of memory reserved for variables and display refresh
 #define STACK_SIZE 16           // Number of 2-byte values the call stack can store
 #define FONT_SIZE 0x50          // The exact number of bytes a given font file should be
@@ -9,10 +10,27 @@
 #define SCREEN_SIZE_Y 32        // Number of vertical pixels in the screen display
 #define SCREEN_SCALE_FACTOR 12  // Resolution multiplier for the display (only for SDL)
 
+static_assert((RAM_SIZE & RAM_ADDRESS_MASK) == 0, "RAM_SIZE must be a power of two for address masking");
+
+// Colour schemes for the CRT display pipeline (only for SDL)
+enum class CrtPalette : uint8_t {
+    White,                      // White phosphor on black
+    Green,                      // P1 green phosphor
+    Amber                       // P3 amber phosphor
+};
+
 struct Chip8Config {
     bool terminalMode;          // Determines whether to render using SDL or ncurses
     uint16_t clockSpeed;        // Number of instructions the CPU executes per second (Hz)
     uint16_t refreshRate;       // How often the display is updated in Hz
     uint16_t romStartOffset;    // Offset in memory where the given ROM is stored
     uint16_t fontStartOffset;   // Offset in memory where the font data is stored
+    bool debug = false;         // Run under the interactive Debugger
+    bool showMetrics = false;   // Show frame-pacing metrics in the window title or below the terminal screen
+
+    // CRT display pipeline (only for SDL)
+    bool crtEffects = false;                    // Render through CrtDisplay instead of drawing raw pixels
+    float phosphorDecay = 0.0f;                 // Fraction of a pixel's brightness kept per frame once it turns off
+    bool scanlines = false;                     // Darken the bottom of every emulated row
+    CrtPalette palette = CrtPalette::White;
 };
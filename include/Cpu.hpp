@@ -8,6 +8,14 @@
 #include "../include/Chip8Config.hpp"
 #include "../include/Utils.hpp"
 
+// Observer used by the plain clock(). Every hook is empty and compiled out,
+// so that instantiation is the same code as an interpreter without any hooks
+struct NullObserver {
+    static constexpr bool enabled = false;
+    inline void onRead(uint16_t) {}
+    inline void onWrite(uint16_t) {}
+};
+
 class Cpu {
     private:
         uint16_t pc;                            // Program counter
@@ -19,6 +27,7 @@ class Cpu {
         std::array<uint8_t, RAM_SIZE> &ram;     // CHIP-8 memory initialized in Chip8.cpp
         std::array<uint16_t, STACK_SIZE> stack; // Call stack
         uint8_t stackPointer;
+        uint32_t randomState;                   // xorshift32 state for CXNN, never 0
 
         // Push a value onto the call stack
         bool stackPush(uint16_t value);
@@ -27,6 +36,14 @@ class Cpu {
         // to indicate that something went wrong
         std::optional<uint16_t> stackPop();
 
+        // Next random byte for CXNN
+        inline uint8_t random() {
+            randomState ^= randomState << 13;
+            randomState ^= randomState >> 17;
+            randomState ^= randomState << 5;
+            return randomState >> 24;
+        }
+
         // Given a 2-byte value, return its last hexadecimal digit
         inline uint8_t    N(uint16_t value) const { return value & 0x000F; };
         // Given a 2-byte value, return its last byte
@@ -43,7 +60,10 @@ class Cpu {
                void opcode0(); inline void opcode1(); inline void opcode2(); inline void opcode3();
         inline void opcode4(); inline void opcode5(); inline void opcode6(); inline void opcode7();
                void opcode8(); inline void opcode9(); inline void opcodeA(); inline void opcodeB();
-        inline void opcodeC();        void opcodeD();        void opcodeE();        void opcodeF();
+        inline void opcodeC();                                     void opcodeE();
+        // Instructions accessing RAM through register I report those accesses to the observer
+        template <typename Observer> void opcodeD(Observer &observer);
+        template <typename Observer> void opcodeF(Observer &observer);
 
         // Screen display defined in Chip8.cpp
         bool *const screen;
@@ -60,19 +80,34 @@ class Cpu {
         // it is not possible to detect key release events with ncurses
         bool autoReleaseKey;
 
+        // Runs code compiled by chip-8-aot directly on this state
+        friend class AotRuntime;
+
     public:
         Cpu(std::array<uint8_t, RAM_SIZE> &ram, uint16_t romStartOffset, uint16_t fontStartOffset, bool *const screen);
         Cpu(Cpu const &cpu);
         ~Cpu();
         uint16_t getPc() const { return pc; };
+        uint16_t getRegI() const { return regI; };
+        std::array<uint8_t, 16> const &getRegisters() const { return reg; };
+        std::array<uint16_t, STACK_SIZE> const &getStack() const { return stack; };
+        uint8_t getStackPointer() const { return stackPointer; };
+        uint8_t getDelayTimer() const { return delayTimer; };
+        uint8_t getSoundTimer() const { return soundTimer; };
         friend std::ostream &operator<<(std::ostream &out, Cpu const &cpu);
 
         // Execute one instruction
         void clock();
+        // Execute one instruction, reporting the RAM read and written by DXYN, FX33, FX55 and FX65
+        // to the observer. Defined in CpuClock.hpp and instantiated next to each observer:
+        // Cpu.cpp for NullObserver (clock()), Debugger.cpp and AotRuntime.cpp
+        template <typename Observer> void clock(Observer &observer);
         // Called at a frequency of 60 Hz
         // to decrement the delay and sound timers
         void updateTimers();
         void pressKey(uint8_t key);
         void releaseKey(uint8_t key);
         void setAutoReleaseKey(bool autoReleaseKey);
+        // Make CXNN repeatable: the same seed gives the same random values
+        void seedRandom(uint32_t seed);
 };
@@ -0,0 +1,152 @@
+#pragma once
+#include "../include/Cpu.hpp"
+
+// Definitions of Cpu::clock(Observer &) and the instructions it inlines, for the files
+// instantiating it: Cpu.cpp (NullObserver), Debugger.cpp and AotRuntime.cpp
+
+template <typename Observer>
+void Cpu::clock(Observer &observer) {
+    // Every RAM access masks its address, so a program counter or I past the end of memory wraps around
+    opcode = (ram[pc & RAM_ADDRESS_MASK] << 8) | ram[(pc+1) & RAM_ADDRESS_MASK];
+    pc += 2;
+
+    switch (opcode >> 12) {
+        case 0x0: opcode0(); break;
+        case 0x1: opcode1(); break;
+        case 0x2: opcode2(); break;
+        case 0x3: opcode3(); break;
+        case 0x4: opcode4(); break;
+        case 0x5: opcode5(); break;
+        case 0x6: opcode6(); break;
+        case 0x7: opcode7(); break;
+        case 0x8: opcode8(); break;
+        case 0x9: opcode9(); break;
+        case 0xA: opcodeA(); break;
+        case 0xB: opcodeB(); break;
+        case 0xC: opcodeC(); break;
+        case 0xD: opcodeD(observer); break;
+        case 0xE: opcodeE(); break;
+        case 0xF: opcodeF(observer); break;
+        default: break;
+    }
+    lastPressedKey = 0x10;
+    lastReleasedKey = 0x10;
+}
+
+// 1NNN: Jump to address NNN
+void Cpu::opcode1() { pc = NNN(opcode); }
+// 2NNN: Call a subroutine (function) at address NNN
+void Cpu::opcode2() {
+    if (!stackPush(pc)) return;
+    opcode1();
+}
+// 3XNN: If the value of register VX is NN, skip the following instruction
+void Cpu::opcode3() {
+    if (reg[X(opcode)] == NN(opcode)) { pc += 2; }
+}
+// 4XNN: If the value of register VX is not NN, skip the following instruction
+void Cpu::opcode4() {
+    if (reg[X(opcode)] != NN(opcode)) { pc += 2; }
+}
+// 5XY0: If the value of register VX is equal to the value of register VY, skip the following instruction
+void Cpu::opcode5() {
+    if (reg[X(opcode)] == reg[Y(opcode)]) { pc += 2; }
+}
+// 6XNN: Store NN in register VX
+void Cpu::opcode6() { reg[X(opcode)]  = NN(opcode); }
+// 7XNN: Add NN to the value of register VX
+void Cpu::opcode7() { reg[X(opcode)] += NN(opcode); }
+// 9XY0: If the value of register VX is not equal to the value of register VY, skip the following instruction
+void Cpu::opcode9() {
+    if (reg[X(opcode)] != reg[Y(opcode)]) { pc += 2; }
+}
+void Cpu::opcodeA() { regI = NNN(opcode); }         // ANNN: Store NNN in register I
+void Cpu::opcodeB() { pc = NNN(opcode) + reg[0]; }  // BNNN: Jump to address NNN + V0
+// CXNN: Set register VX to a random value bitwise AND'd with NN
+void Cpu::opcodeC() { reg[X(opcode)] = random() & NN(opcode); }
+// DXYN: Draw a sprite at screen position (VX, VY) using N bytes of sprite data stored at the offset in memory specified by register I,
+// setting register VF to 1 if any pixels are turned off after drawing, 0 otherwise
+template <typename Observer>
+void Cpu::opcodeD(Observer &observer) {
+    // The sprite position wraps around the screen, so take the modulo
+    uint8_t xPos = reg[X(opcode)] % SCREEN_SIZE_X;
+    uint8_t yPos = reg[Y(opcode)] % SCREEN_SIZE_Y;
+    reg[0xF] = 0;
+    // The sprite data offset also corresponds to the y-position;
+    // the N bytes of sprite data is vertically stacked
+    for (int y = 0; y < N(opcode); y++) {
+        if (yPos+y >= SCREEN_SIZE_Y) break;     // The sprite itself does not wrap
+        uint16_t const address = (regI+y) & RAM_ADDRESS_MASK;
+        uint8_t spriteData = ram[address];
+        if constexpr (Observer::enabled) observer.onRead(address);
+        for (int x = 0; x < 8; x++) {
+            if (xPos+x >= SCREEN_SIZE_X) break; // The sprite itself does not wrap
+            // Each byte of sprite data is 8 horizontal pixels
+            if ((spriteData >> (7-x)) & 0x01) {
+                bool *pixel = screen+(yPos+y)*SCREEN_SIZE_X+xPos+x;
+                if (*pixel) {
+                    reg[0xF] = 1;
+                    *pixel = false;
+                } else *pixel = true;
+            }
+        }
+    }
+}
+template <typename Observer>
+void Cpu::opcodeF(Observer &observer) {
+    uint8_t subOpCode = NN(opcode);
+    switch (subOpCode) {
+        case 0x07: reg[X(opcode)] = delayTimer; break;  // FX07: Store the current value of the delay timer in register VX
+        case 0x0A:                                      // FX0A: Wait for a keypress and store the result in register VX
+            if (!autoReleaseKey) {
+                if (lastReleasedKey > 0xF) pc -= 2;     // Waiting is done by decrementing the program counter
+                else {
+                    reg[X(opcode)] = lastReleasedKey;
+                    lastReleasedKey = 0x10;
+                }
+            } else {
+                if (lastPressedKey > 0xF) pc -= 2;      // Waiting is done by decrementing the program counter
+                else {
+                    reg[X(opcode)] = lastPressedKey;
+                    releaseKey(lastPressedKey);
+                    lastPressedKey = 0x10;
+                }
+            }
+            break;
+        case 0x15: delayTimer = reg[X(opcode)]; break;              // FX15: Set the delay timer to the value of register VX
+        case 0x18: soundTimer = reg[X(opcode)]; break;              // FX18: Set the sound timer to the value of register VX
+        case 0x1E: regI += reg[X(opcode)]; break;                   // FX1E: Add the value of register VX to register I
+        // FX29: Set register I to the memory address of font sprite data for the hexadecimal digit specified by register VX
+        case 0x29: regI = fontStartOffset+reg[X(opcode)]*5; break;
+        // FX33: Store the value of VX as three base-10 digits at memory addresses I, I+1, and I+2
+        case 0x33: {
+            uint8_t value = reg[X(opcode)];
+            ram[regI & RAM_ADDRESS_MASK] = value/100;
+            ram[(regI+1) & RAM_ADDRESS_MASK] = value/10%10;
+            ram[(regI+2) & RAM_ADDRESS_MASK] = value%100%10;
+            if constexpr (Observer::enabled) {
+                for (int i = 0; i < 3; i++) observer.onWrite((regI+i) & RAM_ADDRESS_MASK);
+            }
+            break;
+        }
+        // FX55: Store the values of registers V0 to VX (inclusive) at memory addresses I, I+1, ..., I+X
+        case 0x55:
+            for (int i = 0; i <= X(opcode); i++) {
+                uint16_t const address = (regI+i) & RAM_ADDRESS_MASK;
+                ram[address] = reg[i];
+                if constexpr (Observer::enabled) observer.onWrite(address);
+            }
+            regI += X(opcode)+1; // Increment register I by X+1
+            break;
+        // FX65: Set the values of registers V0 to VX (inclusive) to values at memory addresses I, I+1, ..., I+X
+        case 0x65:
+            for (int i = 0; i <= X(opcode); i++) {
+                uint16_t const address = (regI+i) & RAM_ADDRESS_MASK;
+                reg[i] = ram[address];
+                if constexpr (Observer::enabled) observer.onRead(address);
+            }
+            regI += X(opcode)+1; // Increment register I by X+1
+            break;
+        default: break;
+    }
+}
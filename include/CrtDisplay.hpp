@@ -0,0 +1,60 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <SDL2/SDL.h>
+#include "../include/Chip8Config.hpp"
+
+// Optional SDL display pipeline emulating a CRT.
+// Every emulated pixel keeps an intensity that decays exponentially once the pixel
+// turns off (phosphor persistence), which hides the flicker of sprites that are
+// erased and redrawn with XOR. Intensities are colour-mapped through a palette,
+// upscaled to the window size with optional scanlines and uploaded as a single
+// streaming texture. The per-frame kernels use SSE2/AVX2 when available.
+class CrtDisplay {
+    private:
+        // Pointers to the per-frame kernels, chosen once for the host CPU
+        struct Kernels {
+            // intensity[i] = screen[i] ? 1 : intensity[i]*decay
+            void (*blend)(float *intensity, bool const *screen, float decay, size_t n);
+            // out[i] = lut[quantized intensity[i]]
+            void (*map)(float const *intensity, uint32_t const *lut, uint32_t *out, size_t n);
+            // out[i] = row[columns[i]]
+            void (*expand)(uint32_t const *row, int32_t const *columns, uint32_t *out, size_t n);
+            // Copy pixels to the texture without polluting the cache
+            void (*copy)(uint32_t *dst, uint32_t const *src, size_t n);
+        };
+        static Kernels selectKernels();
+
+        SDL_Renderer *const renderer;
+        SDL_Texture *texture;
+        Kernels const kernels;
+        float const decay;
+        bool const scanlines;
+        int width;
+        int height;
+
+        alignas(32) std::array<float, SCREEN_SIZE_X*SCREEN_SIZE_Y> intensity;
+        alignas(32) std::array<uint32_t, 256> palette;      // Colour for each quantized intensity
+        alignas(32) std::array<uint32_t, 256> dimPalette;   // The same colours darkened for scanlines
+        alignas(32) std::array<uint32_t, SCREEN_SIZE_X*SCREEN_SIZE_Y> colours;
+        alignas(32) std::array<uint32_t, SCREEN_SIZE_X*SCREEN_SIZE_Y> dimColours;
+        std::vector<int32_t> columnSource;  // Emulated x coordinate of every output column
+        std::vector<int32_t> rowSource;     // Index into scaledRows of every output row
+        std::vector<uint32_t> scaledRows;   // Every emulated row upscaled horizontally, then its scanline variant
+
+    public:
+        // The renderer may be null when only compose() is used (e.g. for benchmarking)
+        CrtDisplay(SDL_Renderer *renderer, Chip8Config const &config);
+        CrtDisplay(CrtDisplay const &crtDisplay) = delete;
+        ~CrtDisplay();
+
+        // Set the output resolution of compose()
+        void resize(int width, int height);
+        // Blend the screen into the phosphor buffer and write the upscaled ARGB8888 frame to pixels,
+        // which must hold the current width x height with the given pitch in bytes
+        void compose(bool const *const screen, uint32_t *pixels, int pitch);
+        // Compose a frame into the streaming texture, sized to the renderer output, and present it.
+        // Returns false if the texture could not be created, nothing is drawn then
+        bool render(bool const *const screen);
+};
@@ -0,0 +1,77 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+#include "../include/Chip8Config.hpp"
+#include "../include/Cpu.hpp"
+
+#define WATCH_READ  0x1
+#define WATCH_WRITE 0x2
+#define DEBUGGER_PANEL_X (SCREEN_SIZE_X*2+2)    // Terminal column where the side panel starts
+#define DEBUGGER_LOG_LINES 6                    // Messages kept in the side panel
+
+// Return the assembly mnemonic of an opcode, e.g. "DRW V0, V1, 5"
+std::string disassemble(uint16_t opcode);
+
+// Interactive debugger enabled with --debug.
+// Chip8 asks shouldBreak() before every instruction and runs the Cpu through
+// the Debugger instantiation of Cpu::clock(), which reports RAM accessed by
+// DXYN, FX33, FX55 and FX65 for watchpoints. In terminal mode it is driven
+// from a side panel next to the screen, in SDL mode through stdin/stdout.
+class Debugger {
+    private:
+        Cpu const &cpu;
+        std::array<uint8_t, RAM_SIZE> const &ram;
+        bool const terminalMode;
+        bool paused;
+        bool resuming;                              // Run the instruction at PC even if it has a breakpoint
+        int stepsLeft;                              // Instructions to run before pausing, 0 when running freely
+        int stepOverTarget;                         // Address to pause at after stepping over a call, -1 if none
+        bool watchpointHit;                         // Set by onRead/onWrite, handled after the instruction
+        std::string watchpointEvent;
+        std::set<uint16_t> breakpoints;
+        std::array<uint8_t, RAM_SIZE> watchpoints;  // WATCH_READ/WATCH_WRITE flags per address
+        std::string command;                        // Command line being typed
+        std::deque<std::string> log;                // Latest messages shown in the terminal panel
+        bool stdinClosed;
+
+        void print(std::string const &line);
+        void hitWatchpoint(uint16_t address, char const *access);
+        void resume(int steps);
+        std::vector<std::string> stateLines() const;
+        std::vector<std::string> disassemblyLines(uint16_t address, int before, int after) const;
+
+    public:
+        static constexpr bool enabled = true;
+
+        Debugger(Cpu const &cpu, std::array<uint8_t, RAM_SIZE> const &ram, bool terminalMode);
+        Debugger(Debugger const &debugger) = delete;
+        ~Debugger();
+
+        // Cpu masks every address it reports
+        inline void onRead(uint16_t address) {
+            if (watchpoints[address] & WATCH_READ) hitWatchpoint(address, "read");
+        }
+        inline void onWrite(uint16_t address) {
+            if (watchpoints[address] & WATCH_WRITE) hitWatchpoint(address, "write");
+        }
+
+        // Called before every instruction, returns true if the CPU must not run it
+        bool shouldBreak();
+        // Called after every instruction run under the debugger
+        void afterInstruction();
+        bool isPaused() const { return paused; };
+        void pause(std::string const &reason);
+        // Run a command line such as "b 2A4" or "step 10"
+        void execute(std::string const &line);
+
+        // Terminal mode: feed a key typed while paused
+        void typeCharacter(int character);
+        // Terminal mode: draw the side panel (before the screen is refreshed)
+        void drawPanel();
+        // SDL mode: run the commands waiting on stdin without blocking
+        void pollStdin();
+};
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "../include/Chip8Config.hpp"
+
+#define PACKED_SCREEN_SIZE (SCREEN_SIZE_X*SCREEN_SIZE_Y/8)  // Bytes in a screen packed to one bit per pixel
+
+// Pack the screen to one bit per pixel, row-major, most significant bit leftmost
+void packScreen(bool const *const screen, uint8_t *packed);
+
+// Append the XOR delta between two packed screens, run-length encoded as repeated
+// [uint8 unchanged bytes][uint8 changed bytes][changed bytes XOR'd with previous].
+// Trailing unchanged bytes are omitted, so identical screens encode to nothing.
+void encodeDelta(uint8_t const *previous, uint8_t const *current, std::vector<uint8_t> &out);
+// Apply an encoded delta to a packed screen in place, returns false if the data is malformed
+bool applyDelta(uint8_t const *data, size_t size, uint8_t *packed);
@@ -0,0 +1,90 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+#define METRICS_BUCKET_NS 50000                 // Width of a histogram bucket (50 us)
+#define METRICS_BUCKETS 2000                    // Buckets cover 0-100 ms, anything longer goes in the last one
+#define METRICS_STATUS_INTERVAL_NS 500000000    // How often the status line is refreshed (0.5 s)
+#define METRICS_STATUS_SIZE 176                 // Enough for any status line
+#define METRICS_STALL_NS 1000000                // Main loop iterations further apart than this (1 ms) are stalls
+
+// Fixed-bucket histogram of durations in nanoseconds, adding a sample never allocates
+class DurationHistogram {
+    private:
+        std::array<uint32_t, METRICS_BUCKETS> buckets;
+        uint64_t count;
+        uint64_t total;
+        uint64_t max;
+
+    public:
+        DurationHistogram() : buckets{0}, count(0), total(0), max(0) {}
+
+        inline void add(uint64_t duration) {
+            uint64_t const bucket = duration/METRICS_BUCKET_NS;
+            buckets[bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS-1]++;
+            count++;
+            total += duration;
+            if (duration > max) max = duration;
+        }
+        // Upper edge of the bucket holding the given fraction of samples, never more than the maximum
+        uint64_t percentile(double fraction) const;
+        // Number of samples in the buckets at or above the duration
+        uint64_t countFrom(uint64_t duration) const;
+        uint64_t getCount() const { return count; };
+        uint64_t getMean() const { return count > 0 ? total/count : 0; };
+        uint64_t getMax() const { return max; };
+};
+
+// Frame-pacing and input latency telemetry for the interactive frontends. Every call is a few
+// additions on the main loop, so it is always recorded; only the status line is optional.
+class Metrics {
+    private:
+        uint64_t const framePeriod;             // Requested time between frames in nanoseconds
+        float const expectedInstructions;       // Instructions per frame at the requested clock speed
+        uint64_t start;                         // Time of the first frame, 0 before it
+        uint64_t lastFrame;                     // Time of the previous frame
+        uint64_t frames;
+        uint64_t missedFrames;                  // Frame periods that passed without a frame being presented
+        uint64_t frameInstructions;             // Instructions executed since the previous frame
+        uint64_t totalInstructions;
+        uint64_t minInstructions;               // Fewest and most instructions executed in one frame
+        uint64_t maxInstructions;
+        uint64_t keyTime;                       // Time of the first key event not yet presented, 0 if none
+        DurationHistogram frameTimes;           // Host time between presented frames
+        DurationHistogram keyLatencies;         // Host time from a key event to the next presented frame
+        // Scheduling jitter of the thread running the main loop, which spins without sleeping,
+        // so any long gap between iterations is time the thread was not running
+        DurationHistogram loopGaps;
+        long startContextSwitches;              // Involuntary context switches before the first frame
+        long contextSwitches;                   // Involuntary context switches since the first frame
+        int lastCpu;                            // Core the previous frame was presented from
+        uint64_t migrations;                    // Frames presented from another core than the previous one
+        // Status line state
+        uint64_t statusTime;
+        uint64_t statusFrames;
+        uint64_t statusInstructions;
+        float statusFps;
+        float statusInstructionsPerFrame;
+
+    public:
+        Metrics(uint16_t clockSpeed, uint16_t refreshRate);
+
+        // Monotonic host time in nanoseconds
+        static uint64_t now();
+
+        inline void instructions(uint64_t count) { frameInstructions += count; };
+        // Call on every iteration of the main loop with the host time since the previous one
+        inline void loopIteration(uint64_t gap) { loopGaps.add(gap); };
+        void keyEvent();
+        // Call right after a frame is presented, returns true when the status line has new figures
+        bool framePresented();
+
+        // One-line summary for a window title or status bar, returns its length
+        size_t statusLine(char *buffer, size_t size) const;
+        // Human-readable report of the whole run
+        void report(std::ostream &out) const;
+        // Write the whole run as one JSON object to the file at the path
+        bool writeJson(char const *const path) const;
+};
@@ -0,0 +1,81 @@
+#pragma once
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../include/Chip8Config.hpp"
+#include "../include/FrameCodec.hpp"
+#include "../include/Scheduling.hpp"
+
+#define RECORDER_RING_SIZE 256          // Frames the emulator may run ahead of the writer thread
+#define RECORDER_FLUSH_SIZE (1 << 20)   // Encoded bytes collected before they are written out
+#define GIF_MAX_CODES 4096              // LZW dictionary size allowed by GIF (12-bit codes)
+
+enum class RecordFormat : uint8_t {
+    Y4m,    // YUV4MPEG2 with only a luma plane (C mono), playable by ffmpeg and mpv
+    Raw,    // Headerless 1-bit frames, row-major, most significant bit leftmost
+    Gif     // Looping animated GIF; identical frames are merged and only the changed area is stored
+};
+
+// Format implied by the extension of a path: .y4m, .gif, anything else is raw
+RecordFormat recordFormatForPath(char const *const path);
+
+// Streams every frame passed to capture() to a file. capture() only packs the
+// screen into a ring of reused buffers; a background thread upscales, encodes
+// and writes the frames. When the writer falls RECORDER_RING_SIZE frames behind,
+// capture() waits for it rather than dropping frames.
+class Recorder {
+    private:
+        RecordFormat const format;
+        unsigned int const scale;           // Output pixels per emulated pixel in each direction
+        uint16_t const frameRate;
+        int fd;
+        bool failed;                        // A write failed, the rest of the recording is discarded
+
+        std::vector<std::array<uint8_t, PACKED_SCREEN_SIZE>> ring;
+        uint64_t head;                      // Frames captured, guarded by mutex
+        uint64_t tail;                      // Frames encoded, guarded by mutex
+        bool stopping;
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::thread writer;
+
+        // Writer thread only
+        std::vector<uint8_t> out;           // Encoded bytes waiting to be written
+        std::vector<uint8_t> row;           // One upscaled row of output
+        std::vector<uint8_t> expansion;     // Upscaled output for every value of a packed byte, rowBytesPerByte each
+        size_t rowBytesPerByte;
+        uint64_t framesEncoded;
+        // GIF: the last frame is held back until a different one shows how long it lasts
+        std::array<uint8_t, PACKED_SCREEN_SIZE> gifPending;
+        std::array<uint8_t, PACKED_SCREEN_SIZE> gifShown;   // Screen as of the last frame written
+        uint64_t gifPendingStart;           // Frame number at which the pending frame appeared
+        bool gifHasPending;
+        std::vector<std::array<int16_t, 2>> gifCodes;       // LZW dictionary: code of prefix+pixel, -1 if none
+        std::vector<uint8_t> gifPixels;     // Colour indices of the sub-image being encoded
+
+        void writerLoop();
+        void encode(uint8_t const *packed);
+        void encodeY4m(uint8_t const *packed);
+        void encodeRaw(uint8_t const *packed);
+        void encodeGif(uint8_t const *packed);
+        void writeGifHeader();
+        void writeGifFrame(uint8_t const *packed, uint64_t start, uint64_t end);
+        void writeGifLzw(int width, int height);
+        void finish();
+        void flush();
+
+    public:
+        Recorder(RecordFormat format, unsigned int scale, uint16_t frameRate);
+        Recorder(Recorder const &recorder) = delete;
+        // Encodes the frames still in the ring and completes the file
+        ~Recorder();
+
+        bool open(char const *const path);
+        // Record one frame
+        void capture(bool const *const screen);
+        // Keep the writer thread off the cores reserved for emulation
+        void pinWriter(SchedulingOptions const &options) { if (writer.joinable()) pinHelperThread(writer.native_handle(), options); };
+};
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <pthread.h>
+#include <sched.h>
+
+// How the thread running the emulation loop is scheduled, set with --cpu, --realtime, --nice and --lock-memory
+struct SchedulingOptions {
+    bool pin = false;               // Restrict the emulation thread to `cpus`
+    cpu_set_t cpus;
+    int realtimePriority = 0;       // SCHED_FIFO priority (1-99), 0 to keep the default policy
+    bool setNice = false;
+    int nice = 0;                   // Nice level (-20 to 19) when setNice
+    bool lockMemory = false;        // Keep the process, or at least the machine state, in RAM
+};
+
+// Parse a list of cores such as "2", "2,3" or "0-3,6" into the set, returns false if it is invalid
+bool parseCpuList(char const *const text, cpu_set_t &cpus);
+// Apply the options to the calling thread. Everything that is permitted is applied,
+// returns false if something was refused. `state` is locked if the whole process cannot be
+bool applyScheduling(SchedulingOptions const &options, void const *state, size_t stateSize);
+// Keep a helper thread off the emulation thread's cores, call before applyScheduling().
+// Does nothing if the emulation thread is not pinned or the helper has no other core
+void pinHelperThread(pthread_t thread, SchedulingOptions const &options);
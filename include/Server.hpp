@@ -0,0 +1,121 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../include/Chip8.hpp"
+#include "../include/FrameCodec.hpp"
+
+#define SERVER_HEADER_SIZE 9            // uint8 type, uint32 session id, uint32 payload length
+#define SERVER_MAX_PAYLOAD RAM_SIZE     // Largest message a client may send (a ROM)
+#define SERVER_MAX_BACKLOG (256*1024)   // Unsent bytes after which a client's frames are skipped
+
+// Messages of the --serve protocol. Every message in either direction is a
+// little-endian SERVER_HEADER_SIZE-byte header followed by the payload.
+enum class ServerMessage : uint8_t {
+    // Client to server
+    Create = 0x01,      // Create a session, answered with Created carrying the new session id
+    LoadRom = 0x02,     // Payload: ROM bytes. Resets the session and starts running it, answered with Ok.
+                        // After the Ok, deltas restart from an all-off screen
+    Key = 0x03,         // Payload: uint8 key, uint8 pressed
+    Subscribe = 0x04,   // Payload: uint8 enabled. Deltas restart from an all-off screen
+    Destroy = 0x05,     // Destroy a session, answered with Ok
+    // Server to client
+    Created = 0x81,
+    Ok = 0x82,
+    Frame = 0x83,       // Payload: uint64 frame number, then a delta as encoded by encodeDelta().
+                        // Frames identical to the last one sent are not sent at all
+    Error = 0xFF        // Payload: error message
+};
+
+// Hosts many independent headless Chip8 sessions in one process.
+// One thread runs an epoll loop that owns every socket, accepts clients, parses
+// requests and ticks all sessions at the refresh rate; the frames themselves are
+// run and delta-encoded on a shared thread pool, which hands the encoded bytes
+// back to the loop through an eventfd.
+class Server {
+    private:
+        // Fixed-size pool of worker threads running queued tasks in order
+        class ThreadPool {
+            private:
+                std::vector<std::thread> workers;
+                std::deque<std::function<void()>> tasks;
+                std::mutex mutex;
+                std::condition_variable condition;
+                bool stopping;
+
+            public:
+                ThreadPool(unsigned int threadCount);
+                ~ThreadPool();
+                void submit(std::function<void()> task);
+        };
+
+        struct Session {
+            uint32_t const id;
+            int const connectionFd;         // Client owning the session
+            std::mutex mutex;               // Guards everything below
+            std::unique_ptr<Chip8> chip8;
+            bool running;                   // Set once a ROM is loaded
+            bool subscribed;
+            std::array<uint8_t, PACKED_SCREEN_SIZE> lastSent;   // Screen the client currently has
+            std::vector<uint8_t> outgoing;  // Encoded frames waiting for the loop thread
+            std::atomic<bool> busy;         // A frame is queued or running on the pool
+            std::atomic<bool> congested;    // The client is not keeping up, skip frames
+
+            Session(uint32_t id, int connectionFd) : id(id), connectionFd(connectionFd), running(false), subscribed(false),
+                lastSent{0}, busy(false), congested(false) {}
+        };
+
+        struct Connection {
+            int const fd;
+            std::vector<uint8_t> in;        // Bytes received but not parsed yet
+            std::vector<uint8_t> out;       // Bytes waiting to be sent
+            size_t outOffset;               // Bytes of `out` already sent
+            bool waitingWritable;           // Registered for EPOLLOUT
+            std::vector<uint32_t> sessions;
+
+            Connection(int fd) : fd(fd), outOffset(0), waitingWritable(false) {}
+        };
+
+        Chip8Config const config;
+        int listenFd;
+        int epollFd;
+        int timerFd;                        // Ticks every session once per frame
+        int wakeFd;                         // eventfd written by workers when frames are ready
+        std::string unixPath;               // Removed on shutdown when listening on a Unix socket
+        std::unique_ptr<ThreadPool> pool;
+        uint32_t nextSessionId;
+        std::unordered_map<uint32_t, std::shared_ptr<Session>> sessions;
+        std::unordered_map<int, std::unique_ptr<Connection>> connections;
+        std::mutex readyMutex;
+        std::vector<uint32_t> ready;        // Sessions with outgoing frames, guarded by readyMutex
+
+        void acceptClients();
+        // Returns false if the connection should be closed
+        bool readClient(Connection &connection);
+        void closeClient(int fd);
+        void handleMessage(Connection &connection, ServerMessage type, uint32_t sessionId, uint8_t const *payload, uint32_t size);
+        void tick();
+        void runSession(std::shared_ptr<Session> session);
+        void collectFrames();
+        void send(Connection &connection, ServerMessage type, uint32_t sessionId, uint8_t const *payload, uint32_t size);
+        // Send as much of the connection's backlog as the socket takes, returns false on error
+        bool flush(Connection &connection);
+
+    public:
+        Server(Chip8Config const config);
+        Server(Server const &server) = delete;
+        ~Server();
+
+        // Listen on "unix:PATH" or "[HOST:]PORT" (TCP, loopback if no host is given)
+        bool listen(char const *const address);
+        // Serve clients until SIGINT or SIGTERM
+        void run();
+};
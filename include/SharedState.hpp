@@ -0,0 +1,80 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include "../include/Chip8Config.hpp"
+#include "../include/Cpu.hpp"
+
+#define SHARED_STATE_MAGIC   0x38504843 // "CHP8" in little-endian byte order
+#define SHARED_STATE_VERSION 1
+
+// Machine state published once per emulated frame
+struct SharedFrame {
+    uint64_t frame;                                     // Number of frames displayed so far
+    uint8_t screen[SCREEN_SIZE_X*SCREEN_SIZE_Y];        // One byte per pixel, 0 or 1, row-major
+    uint8_t reg[16];                                    // V0, V1, ..., VF
+    uint16_t pc;
+    uint16_t regI;
+    uint16_t stack[STACK_SIZE];
+    uint8_t stackPointer;
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+};
+
+// Layout of the POSIX shared-memory segment created with --shared-memory NAME.
+// The frame is protected by a seqlock: the emulator makes `sequence` odd while
+// it writes and even again when done, so readers copy the frame in place and
+// retry if the sequence changed or was odd. Readers drive the emulator by
+// setting bits of `keys` (bit N held = CHIP-8 key N held), which is polled
+// by the main loop and turned into Cpu::pressKey/releaseKey calls.
+struct SharedSegment {
+    uint32_t magic;                     // SHARED_STATE_MAGIC once the segment is initialized
+    uint32_t version;                   // SHARED_STATE_VERSION
+    uint32_t size;                      // sizeof(SharedSegment)
+    std::atomic<uint32_t> sequence;
+    SharedFrame frame;
+    std::atomic<uint16_t> keys;
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint16_t>::is_always_lock_free,
+    "Shared-memory atomics must be lock-free to work across processes");
+
+// Copy a consistent snapshot of the published frame, for use by external processes
+inline void readSharedFrame(SharedSegment const &segment, SharedFrame &out) {
+    while (true) {
+        uint32_t before = segment.sequence.load(std::memory_order_acquire);
+        if (before & 1) continue;
+        std::memcpy(&out, &segment.frame, sizeof(out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (segment.sequence.load(std::memory_order_relaxed) == before) return;
+    }
+}
+// Press or release a CHIP-8 key from an external process
+inline void setSharedKey(SharedSegment &segment, uint8_t key, bool pressed) {
+    if (key > 0xF) return;
+    if (pressed) segment.keys.fetch_or(uint16_t(1u << key), std::memory_order_release);
+    else segment.keys.fetch_and(uint16_t(~(1u << key)), std::memory_order_release);
+}
+
+// Owner side of the shared-memory segment, used by Chip8
+class SharedState {
+    private:
+        std::string name;
+        int fd;
+        SharedSegment *segment;
+        uint16_t appliedKeys;   // Key mask last forwarded to the CPU
+
+    public:
+        SharedState();
+        SharedState(SharedState const &sharedState) = delete;
+        ~SharedState();
+
+        // Create the segment with the given name, failing if it already exists; a leading '/' is added if missing
+        bool open(char const *const name);
+        // Write the current machine state, called once per emulated frame
+        void publish(Cpu const &cpu, bool const *const screen, uint64_t frame);
+        // Forward key changes made by external processes to the CPU
+        void pollKeys(Cpu &cpu);
+};
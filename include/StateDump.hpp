@@ -0,0 +1,54 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../include/Chip8Config.hpp"
+#include "../include/Cpu.hpp"
+#include "../include/FrameCodec.hpp"
+
+#define STATE_DUMP_RAM      0x1         // Include the whole RAM
+#define STATE_DUMP_SCREEN   0x2         // Include the screen, packed as by packScreen()
+
+#define STATE_DUMP_MAGIC    0x44533843  // "C8SD" in little-endian byte order
+#define STATE_DUMP_VERSION  1
+#define STATE_DUMP_MAX_SIZE 16384       // Enough for a dump with every section in either format
+
+enum class DumpFormat : uint8_t {
+    // One line of JSON:
+    // {"frame":N,"pc":N,"i":N,"v":[16 x N],"stack":[16 x N],"sp":N,"dt":N,"st":N,"ram":"HEX","screen":"HEX"}
+    // where "ram" and "screen" are only present if requested and hold two hex digits per byte
+    Json,
+    // Little-endian, no padding:
+    // uint32 magic, uint8 version, uint8 sections, uint64 frame, uint16 pc, uint16 i, uint8 v[16],
+    // uint16 stack[STACK_SIZE], uint8 sp, uint8 dt, uint8 st, then RAM_SIZE bytes of RAM
+    // and PACKED_SCREEN_SIZE bytes of screen if requested
+    Binary
+};
+
+// Write the machine state into the buffer without allocating,
+// returns the number of bytes written or 0 if the buffer is too small
+size_t dumpState(Cpu const &cpu, std::array<uint8_t, RAM_SIZE> const &ram, bool const *const screen, uint64_t frame,
+    DumpFormat format, uint8_t sections, char *buffer, size_t size);
+
+// Writes a dump to a file every few frames, for --dump-every
+class StateDumper {
+    private:
+        int fd;
+        bool ownsFd;                    // False when writing to standard error
+        uint64_t const interval;
+        DumpFormat const format;
+        uint8_t const sections;
+        std::vector<char> buffer;       // Allocated once, STATE_DUMP_MAX_SIZE bytes
+
+    public:
+        StateDumper(uint64_t interval, DumpFormat format, uint8_t sections);
+        StateDumper(StateDumper const &dumper) = delete;
+        ~StateDumper();
+
+        // Append dumps to the file at the path, or to standard error if it is null
+        bool open(char const *const path);
+        // Called after every frame, dumps every `interval` frames
+        void frame(Cpu const &cpu, std::array<uint8_t, RAM_SIZE> const &ram, bool const *const screen, uint64_t frame);
+};
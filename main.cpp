@@ -1,4 +1,5 @@
 #include "include/Chip8.hpp"
+#include "include/Server.hpp"
 
 int main(int argc, char *argv[]) {
     if (argc < 2) {
@@ -8,8 +9,28 @@ int main(int argc, char *argv[]) {
 	}
 
 	bool terminalMode = false;
+	bool debug = false;
 	uint16_t clockSpeed = 900;
 	uint16_t refreshRate = 60;
+	bool crtEffects = false;
+	float phosphorDecay = 0.0f;
+	bool scanlines = false;
+	CrtPalette palette = CrtPalette::White;
+	char *sharedMemoryName = nullptr;
+	char *serveAddress = nullptr;
+	uint64_t dumpInterval = 0;
+	char *dumpPath = nullptr;
+	DumpFormat dumpFormat = DumpFormat::Json;
+	uint8_t dumpSections = 0;
+	char *recordPath = nullptr;
+	std::optional<RecordFormat> recordFormat;
+	unsigned int recordScale = 1;
+	bool headless = false;
+	uint64_t frames = 0;
+	bool showMetrics = false;
+	char *metricsPath = nullptr;
+	SchedulingOptions scheduling;
+	bool schedulingRequested = false;
 	bool fontSpecified = false;
 	bool romSpecified = false;
 	char *fontPath;
@@ -19,12 +40,37 @@ int main(int argc, char *argv[]) {
         if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "-help") == 0 || strcmp(argv[i], "--help") == 0) {
             std::cout << "Usage: chip-8 [OPTIONS] [INPUT FILE]\n\nwith options:\n"
 			"-t, --terminal-mode\nUse this option if the emulated display is to be output in the terminal.\n"
+			"-d, --debug\nStart paused in the interactive debugger (side panel in terminal mode, stdin otherwise).\n"
 			"-f, --font PATH\nPath to custom font file (max 80 bytes).\n"
 			"-c, --clock-speed VALUE\nNumber of instructions the CPU executes per second (Hz). Default is 900 Hz.\n"
-			"-r, --refresh-rate VALUE\nHow often the display is updated in Hz. Default is 60 Hz." << std::endl;
+			"-r, --refresh-rate VALUE\nHow often the display is updated in Hz. Default is 60 Hz.\n"
+			"-p, --phosphor VALUE\nFraction (0-1) of a pixel's brightness kept every frame after it turns off, to reduce flicker (SDL only).\n"
+			"-s, --scanlines\nDarken the gap between emulated rows like a CRT (SDL only).\n"
+			"--palette NAME\nColour scheme of the display: white (default), green or amber (SDL only).\n"
+			"--shared-memory NAME\nPublish the screen, registers and timers to the POSIX shared-memory segment NAME every frame and read key input from it.\n"
+			"--serve ADDRESS\nInstead of running a ROM, host emulator sessions for clients on ADDRESS (unix:PATH or [HOST:]PORT).\n"
+			"--dump-every VALUE\nDump the registers, stack and timers every VALUE frames.\n"
+			"--dump-file PATH\nAppend dumps to PATH instead of standard error. Required in terminal mode.\n"
+			"--dump-format NAME\nFormat of dumps: json (default, one object per line) or binary, see include/StateDump.hpp.\n"
+			"--dump-ram\nInclude the RAM in dumps.\n"
+			"--dump-screen\nInclude the screen in dumps.\n"
+			"--record PATH\nRecord every frame to PATH, as Y4M video (.y4m), an animated GIF (.gif) or raw 1-bit frames (anything else).\n"
+			"--record-format NAME\nRecord as y4m, gif or raw regardless of the file extension.\n"
+			"--record-scale VALUE\nScale recorded frames up by VALUE in each direction. Default is 1.\n"
+			"--headless\nRun without a display as fast as possible, until --frames frames have run or the process is interrupted.\n"
+			"--frames VALUE\nNumber of frames to run with --headless.\n"
+			"--metrics\nShow frame pacing and input latency in the window title or below the terminal screen, and a report on exit.\n"
+			"--metrics-file PATH\nWrite the frame pacing and input latency of the run to PATH as JSON on exit.\n"
+			"--cpu LIST\nPin the emulation thread to the given cores, e.g. 2, 2,3 or 2-3. Recording is kept off them.\n"
+			"--realtime VALUE\nRun the emulation thread with SCHED_FIFO at priority VALUE (1-99), if permitted. Requires --cpu.\n"
+			"--nice VALUE\nRun the emulation thread at nice level VALUE (-20 to 19), if permitted.\n"
+			"--lock-memory\nLock the process, or at least the machine state, in RAM so it is never paged out.\n"
+			"Any of these also reports the scheduling jitter observed on exit. Not available with --headless or --serve." << std::endl;
             return EXIT_SUCCESS;
         } else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--terminal-mode") == 0) {
 			terminalMode = true;
+        } else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--debug") == 0) {
+			debug = true;
         } else if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--font") == 0) {
 			if (i+1 < argc) {
 				fontPath = argv[++i];
@@ -51,7 +97,8 @@ int main(int argc, char *argv[]) {
             if (i+1 < argc) {
 				try {
 					int r = std::stoi(argv[++i]);
-					if (r < 0) throw 1;
+					// Every frontend and subsystem divides by the rate, so 0 (also from overflowing 16 bits) never gets past here
+					if (r < 1 || r > UINT16_MAX) throw 1;
 					refreshRate = r;
 				} catch (...) {
 					std::cerr << "--refresh-rate option must be a positive number." << std::endl;
@@ -61,6 +108,197 @@ int main(int argc, char *argv[]) {
                 std::cerr << "--refresh-rate option requires one argument." << std::endl;
                 return EXIT_FAILURE;
             }
+        } else if (strcmp(argv[i], "-p") == 0 || strcmp(argv[i], "--phosphor") == 0) {
+            if (i+1 < argc) {
+				try {
+					float p = std::stof(argv[++i]);
+					if (p < 0.0f || p > 1.0f) throw 1;
+					phosphorDecay = p;
+					crtEffects = true;
+				} catch (...) {
+					std::cerr << "--phosphor option must be a number between 0 and 1." << std::endl;
+					return EXIT_FAILURE;
+				}
+            } else {
+                std::cerr << "--phosphor option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "-s") == 0 || strcmp(argv[i], "--scanlines") == 0) {
+			scanlines = true;
+			crtEffects = true;
+        } else if (strcmp(argv[i], "--palette") == 0) {
+            if (i+1 < argc) {
+				char const *name = argv[++i];
+				if (strcmp(name, "white") == 0) palette = CrtPalette::White;
+				else if (strcmp(name, "green") == 0) palette = CrtPalette::Green;
+				else if (strcmp(name, "amber") == 0) palette = CrtPalette::Amber;
+				else {
+					std::cerr << "--palette option must be one of white, green or amber." << std::endl;
+					return EXIT_FAILURE;
+				}
+				crtEffects = true;
+            } else {
+                std::cerr << "--palette option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--shared-memory") == 0) {
+            if (i+1 < argc) {
+				sharedMemoryName = argv[++i];
+            } else {
+                std::cerr << "--shared-memory option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            if (i+1 < argc) {
+				serveAddress = argv[++i];
+            } else {
+                std::cerr << "--serve option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--dump-every") == 0) {
+            if (i+1 < argc) {
+				try {
+					long long d = std::stoll(argv[++i]);
+					if (d <= 0) throw 1;
+					dumpInterval = d;
+				} catch (...) {
+					std::cerr << "--dump-every option must be a positive number." << std::endl;
+					return EXIT_FAILURE;
+				}
+            } else {
+                std::cerr << "--dump-every option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--dump-file") == 0) {
+            if (i+1 < argc) {
+				dumpPath = argv[++i];
+            } else {
+                std::cerr << "--dump-file option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--dump-format") == 0) {
+            if (i+1 < argc) {
+				char const *name = argv[++i];
+				if (strcmp(name, "json") == 0) dumpFormat = DumpFormat::Json;
+				else if (strcmp(name, "binary") == 0) dumpFormat = DumpFormat::Binary;
+				else {
+					std::cerr << "--dump-format option must be one of json or binary." << std::endl;
+					return EXIT_FAILURE;
+				}
+            } else {
+                std::cerr << "--dump-format option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--dump-ram") == 0) {
+			dumpSections |= STATE_DUMP_RAM;
+        } else if (strcmp(argv[i], "--dump-screen") == 0) {
+			dumpSections |= STATE_DUMP_SCREEN;
+        } else if (strcmp(argv[i], "--record") == 0) {
+            if (i+1 < argc) {
+				recordPath = argv[++i];
+            } else {
+                std::cerr << "--record option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--record-format") == 0) {
+            if (i+1 < argc) {
+				char const *name = argv[++i];
+				if (strcmp(name, "y4m") == 0) recordFormat = RecordFormat::Y4m;
+				else if (strcmp(name, "gif") == 0) recordFormat = RecordFormat::Gif;
+				else if (strcmp(name, "raw") == 0) recordFormat = RecordFormat::Raw;
+				else {
+					std::cerr << "--record-format option must be one of y4m, gif or raw." << std::endl;
+					return EXIT_FAILURE;
+				}
+            } else {
+                std::cerr << "--record-format option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--record-scale") == 0) {
+            if (i+1 < argc) {
+				try {
+					int s = std::stoi(argv[++i]);
+					if (s < 1 || s > 64) throw 1;
+					recordScale = s;
+				} catch (...) {
+					std::cerr << "--record-scale option must be a number between 1 and 64." << std::endl;
+					return EXIT_FAILURE;
+				}
+            } else {
+                std::cerr << "--record-scale option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+        } else if (strcmp(argv[i], "--frames") == 0) {
+            if (i+1 < argc) {
+				try {
+					long long f = std::stoll(argv[++i]);
+					if (f <= 0) throw 1;
+					frames = f;
+				} catch (...) {
+					std::cerr << "--frames option must be a positive number." << std::endl;
+					return EXIT_FAILURE;
+				}
+            } else {
+                std::cerr << "--frames option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--metrics") == 0) {
+			showMetrics = true;
+        } else if (strcmp(argv[i], "--metrics-file") == 0) {
+            if (i+1 < argc) {
+				metricsPath = argv[++i];
+            } else {
+                std::cerr << "--metrics-file option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--cpu") == 0) {
+            if (i+1 < argc) {
+				if (!parseCpuList(argv[++i], scheduling.cpus)) {
+					std::cerr << "--cpu option must be a list of cores such as 2, 2,3 or 2-3." << std::endl;
+					return EXIT_FAILURE;
+				}
+				scheduling.pin = true;
+				schedulingRequested = true;
+            } else {
+                std::cerr << "--cpu option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            if (i+1 < argc) {
+				try {
+					int p = std::stoi(argv[++i]);
+					if (p < 1 || p > 99) throw 1;
+					scheduling.realtimePriority = p;
+					schedulingRequested = true;
+				} catch (...) {
+					std::cerr << "--realtime option must be a priority between 1 and 99." << std::endl;
+					return EXIT_FAILURE;
+				}
+            } else {
+                std::cerr << "--realtime option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--nice") == 0) {
+            if (i+1 < argc) {
+				try {
+					int n = std::stoi(argv[++i]);
+					if (n < -20 || n > 19) throw 1;
+					scheduling.nice = n;
+					scheduling.setNice = true;
+					schedulingRequested = true;
+				} catch (...) {
+					std::cerr << "--nice option must be a number between -20 and 19." << std::endl;
+					return EXIT_FAILURE;
+				}
+            } else {
+                std::cerr << "--nice option requires one argument." << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(argv[i], "--lock-memory") == 0) {
+			scheduling.lockMemory = true;
+			schedulingRequested = true;
         } else {
             romPath = argv[i];
 			romSpecified = true;
@@ -72,14 +310,64 @@ int main(int argc, char *argv[]) {
 		.clockSpeed = clockSpeed,
 		.refreshRate = refreshRate,
 		.romStartOffset = 0x0200,	// Conventional value
-		.fontStartOffset = 0x0050	// Conventional value
+		.fontStartOffset = 0x0050,	// Conventional value
+		.debug = debug,
+		.showMetrics = showMetrics,
+		.crtEffects = crtEffects,
+		.phosphorDecay = phosphorDecay,
+		.scanlines = scanlines,
+		.palette = palette
 	};
+
+	if (headless && debug) {
+		std::cerr << "--headless and --debug options cannot be combined." << std::endl;
+		return EXIT_FAILURE;
+	}
+	// Standard error would be written over the ncurses screen
+	if (terminalMode && !headless && dumpInterval > 0 && dumpPath == nullptr) {
+		std::cerr << "--dump-every option in terminal mode requires --dump-file." << std::endl;
+		return EXIT_FAILURE;
+	}
+	// The main loop spins, under SCHED_FIFO it would starve every other thread sharing its core
+	if (scheduling.realtimePriority > 0 && !scheduling.pin) {
+		std::cerr << "--realtime option requires --cpu." << std::endl;
+		return EXIT_FAILURE;
+	}
+	// Headless runs present no frames, so there would be no jitter to report
+	if (headless && schedulingRequested) {
+		std::cerr << "--headless cannot be combined with --cpu, --realtime, --nice or --lock-memory." << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (serveAddress != nullptr && schedulingRequested) {
+		std::cerr << "--serve cannot be combined with --cpu, --realtime, --nice or --lock-memory." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (serveAddress != nullptr) {
+		Server server = Server(config);
+		if (!server.listen(serveAddress)) return EXIT_FAILURE;
+		server.run();
+		return EXIT_SUCCESS;
+	}
+
 	Chip8 chip8 = Chip8(config);
 
 	if (fontSpecified && !chip8.loadFont(fontPath)) std::cerr << "Font was not loaded! Continuing with default font." << std::endl;
 
-	if (romSpecified && chip8.loadRom(romPath)) chip8.start();
-	else return EXIT_FAILURE;
+	if (sharedMemoryName != nullptr && !chip8.exportSharedState(sharedMemoryName)) return EXIT_FAILURE;
+	if (dumpInterval > 0 && !chip8.dumpStateEvery(dumpInterval, dumpPath, dumpFormat, dumpSections)) return EXIT_FAILURE;
+
+	if (recordPath != nullptr && !chip8.record(recordPath, recordFormat.value_or(recordFormatForPath(recordPath)), recordScale)) return EXIT_FAILURE;
+
+	if (schedulingRequested) chip8.setScheduling(scheduling);
+
+	if (!romSpecified || !chip8.loadRom(romPath)) return EXIT_FAILURE;
+	if (headless) chip8.runHeadless(frames);
+	else chip8.start();
+
+	// Metrics cover the interactive frontends, headless runs are not paced
+	if (!headless && (showMetrics || schedulingRequested)) chip8.getMetrics().report(std::cerr);
+	if (metricsPath != nullptr && !chip8.getMetrics().writeJson(metricsPath)) return EXIT_FAILURE;
 
 	return EXIT_SUCCESS;
 }
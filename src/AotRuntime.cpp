@@ -0,0 +1,84 @@
+#include <algorithm>
+#include "../include/AotRuntime.hpp"
+#include "../include/CpuClock.hpp"
+
+AotRuntime::AotRuntime(Cpu &cpu, AotProgram const &program) :
+    cpu(cpu),
+    program(program),
+    invalid(program.blockCount, false),
+    compiled{false},
+    V(cpu.reg),
+    I(cpu.regI),
+    pc(cpu.pc),
+    delayTimer(cpu.delayTimer),
+    soundTimer(cpu.soundTimer),
+    fontStartOffset(cpu.fontStartOffset),
+    codeModified(false) {
+        TRACE("[AOT: Creating new AotRuntime " << this << " for " << program.name << "]");
+        entries.fill(-1);
+        for (size_t i = 0; i < program.blockCount; i++) {
+            AotBlock const &block = program.blocks[i];
+            entries[block.start] = i;
+            std::fill(compiled.begin()+block.start, compiled.begin()+block.end, true);
+        }
+    }
+AotRuntime::AotRuntime(Cpu &cpu, AotRuntime const &runtime) :
+    cpu(cpu),
+    program(runtime.program),
+    entries(runtime.entries),
+    invalid(runtime.invalid),
+    compiled(runtime.compiled),
+    V(cpu.reg),
+    I(cpu.regI),
+    pc(cpu.pc),
+    delayTimer(cpu.delayTimer),
+    soundTimer(cpu.soundTimer),
+    fontStartOffset(cpu.fontStartOffset),
+    codeModified(false) {
+        TRACE("[AOT: Copy constructor for AotRuntime " << this << ", copied from " << &runtime << "]");
+    }
+AotRuntime::~AotRuntime() { TRACE("[AOT: deleting AotRuntime " << this << "]"); }
+
+bool AotRuntime::matches(std::array<uint8_t, RAM_SIZE> const &ram) const {
+    if (program.romStartOffset+program.romSize > RAM_SIZE) return false;
+    return std::equal(program.rom, program.rom+program.romSize, ram.begin()+program.romStartOffset);
+}
+
+void AotRuntime::invalidate(uint16_t address) {
+    for (size_t i = 0; i < program.blockCount; i++) {
+        if (program.blocks[i].start <= address && address < program.blocks[i].end) invalid[i] = true;
+    }
+    codeModified = true;
+}
+
+void AotRuntime::run(uint64_t instructions) {
+    while (instructions > 0) {
+        int32_t const index = pc < RAM_SIZE ? entries[pc] : -1;
+        if (index < 0 || invalid[index]) {
+            cpu.clock(*this);
+            instructions--;
+            continue;
+        }
+        uint32_t const budget = std::min<uint64_t>(instructions, AOT_MAX_CHAIN_INSTRUCTIONS);
+        codeModified = false;
+        instructions -= budget-program.blocks[index].function(*this, budget);
+        // Cpu::clock() forgets key events after every instruction
+        cpu.lastPressedKey = 0x10;
+        cpu.lastReleasedKey = 0x10;
+    }
+}
+
+void AotRuntime::execute(uint16_t opcode) {
+    cpu.opcode = opcode;
+    if ((opcode >> 12) == 0xD) cpu.opcodeD(*this);
+    else cpu.opcodeF(*this);
+}
+void AotRuntime::clearScreen() {
+    std::fill_n(cpu.screen, SCREEN_SIZE_X*SCREEN_SIZE_Y, false);
+}
+
+// Code compiled by chip-8-aot falls back to the interpreter through these,
+// so that stores into compiled code are noticed wherever they happen
+template void Cpu::clock<AotRuntime>(AotRuntime &observer);
+template void Cpu::opcodeD<AotRuntime>(AotRuntime &observer);
+template void Cpu::opcodeF<AotRuntime>(AotRuntime &observer);
@@ -1,12 +1,31 @@
+#include <csignal>
+#include <cstring>
 #include "../include/Chip8.hpp"
 
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+void requestStop(int) { stopRequested = 1; }
+
+} // namespace
+
 Chip8::Chip8(Chip8Config const config) :
     config(config),
     running(false),
     romSize(0),
     ram{0},
     screen{false},
-    cpu(Cpu(ram, config.romStartOffset, config.fontStartOffset, screen.data())) {
+    cpu(Cpu(ram, config.romStartOffset, config.fontStartOffset, screen.data())),
+    frameCount(0),
+    frameClockAccumulator(0.0f),
+    frameTimerAccumulator(0.0f),
+    metrics(config.clockSpeed, config.refreshRate),
+    sharedState(nullptr),
+    stateDumper(nullptr),
+    recorder(nullptr),
+    debugger(config.debug ? std::make_unique<Debugger>(cpu, ram, config.terminalMode) : nullptr),
+    aotRuntime(nullptr),
+    scheduling(std::nullopt) {
         TRACE("[CHIP8: Creating new Chip8 " << this << "]");
         if (config.terminalMode) cpu.setAutoReleaseKey(true);
         // Copy the default font data to CHIP-8 memory
@@ -18,7 +37,17 @@ Chip8::Chip8(Chip8 const &chip8) :
     romSize(chip8.romSize),
     ram(chip8.ram),
     screen(chip8.screen),
-    cpu(chip8.cpu) {
+    cpu(chip8.cpu),
+    frameCount(chip8.frameCount),
+    frameClockAccumulator(chip8.frameClockAccumulator),
+    frameTimerAccumulator(chip8.frameTimerAccumulator),
+    metrics(config.clockSpeed, config.refreshRate),
+    sharedState(nullptr), // The shared-memory segment stays with the original
+    stateDumper(nullptr),
+    recorder(nullptr),
+    debugger(config.debug ? std::make_unique<Debugger>(cpu, ram, config.terminalMode) : nullptr),
+    aotRuntime(chip8.aotRuntime ? std::make_unique<AotRuntime>(cpu, *chip8.aotRuntime) : nullptr),
+    scheduling(chip8.scheduling) {
     TRACE("[CHIP8: Copy constructor for Chip8 " << this << ", copied from " << &chip8 << "]");
 }
 Chip8::~Chip8() { TRACE("[CHIP8: deleting Chip8 " << this << "]"); }
@@ -100,17 +129,71 @@ bool Chip8::loadRom(char const *const romPath) {
     }
     // tellg reports correct file size since it's opened in binary mode
     file.seekg(0, std::ios::end);
-    romSize = file.tellg();
+    size_t fileSize = file.tellg();
     size_t max_size = RAM_SIZE-RESERVED_BYTES-config.romStartOffset;
-    if (romSize > max_size) {
+    if (fileSize > max_size) {
         std::cerr << "Error! ROM is too large for memory, must be at most " << max_size << " bytes" << std::endl;
         file.close();
         return false;
     }
     file.clear();
     file.seekg(0);
-    file.read(reinterpret_cast<char *>(&ram[config.romStartOffset]), romSize);
+    file.read(reinterpret_cast<char *>(&ram[config.romStartOffset]), fileSize);
     file.close();
+    romSize = fileSize;
+    return true;
+}
+bool Chip8::loadRom(uint8_t const *const data, size_t size) {
+    size_t max_size = RAM_SIZE-RESERVED_BYTES-config.romStartOffset;
+    if (size > max_size) {
+        std::cerr << "Error! ROM is too large for memory, must be at most " << max_size << " bytes" << std::endl;
+        return false;
+    }
+    std::copy_n(data, size, ram.begin()+config.romStartOffset);
+    romSize = size;
+    return true;
+}
+
+bool Chip8::exportSharedState(char const *const name) {
+    std::unique_ptr<SharedState> state = std::make_unique<SharedState>();
+    if (!state->open(name)) return false;
+    sharedState = std::move(state);
+    return true;
+}
+
+bool Chip8::dumpStateEvery(uint64_t frames, char const *const path, DumpFormat format, uint8_t sections) {
+    std::unique_ptr<StateDumper> dumper = std::make_unique<StateDumper>(frames, format, sections);
+    if (!dumper->open(path)) return false;
+    stateDumper = std::move(dumper);
+    return true;
+}
+size_t Chip8::dumpState(char *buffer, size_t size, DumpFormat format, uint8_t sections) const {
+    return ::dumpState(cpu, ram, screen.data(), frameCount, format, sections, buffer, size);
+}
+
+bool Chip8::record(char const *const path, RecordFormat format, unsigned int scale) {
+    // GIF delays are computed from the frame rate
+    if (config.refreshRate == 0) {
+        std::cerr << "Error! Cannot record with a refresh rate of 0" << std::endl;
+        return false;
+    }
+    std::unique_ptr<Recorder> newRecorder = std::make_unique<Recorder>(format, scale, config.refreshRate);
+    if (!newRecorder->open(path)) return false;
+    recorder = std::move(newRecorder);
+    return true;
+}
+
+bool Chip8::useAotProgram(AotProgram const &program) {
+    if (debugger) {
+        std::cerr << "Error! Compiled programs cannot run under the debugger" << std::endl;
+        return false;
+    }
+    std::unique_ptr<AotRuntime> runtime = std::make_unique<AotRuntime>(cpu, program);
+    if (program.romStartOffset != config.romStartOffset || !runtime->matches(ram)) {
+        std::cerr << "Error! Program " << program.name << " was compiled from a different ROM than the one loaded" << std::endl;
+        return false;
+    }
+    aotRuntime = std::move(runtime);
     return true;
 }
 
@@ -123,6 +206,7 @@ void Chip8::handleSdlInput(SDL_Event &e) {
                 case SDL_SCANCODE_ESCAPE:
                 case SDL_SCANCODE_RETURN:
                 case SDL_SCANCODE_RETURN2: running = false; break;
+                case SDL_SCANCODE_TAB: if (debugger && e.type == SDL_KEYDOWN) debugger->pause("Paused"); break;
                 case SDL_SCANCODE_1: key = 0x1; break;
                 case SDL_SCANCODE_2: key = 0x2; break;
                 case SDL_SCANCODE_3: key = 0x3; break;
@@ -142,6 +226,7 @@ void Chip8::handleSdlInput(SDL_Event &e) {
                 default: break;
             }
             if (key > 0xF) break;
+            metrics.keyEvent();
             if (e.type == SDL_KEYDOWN) cpu.pressKey(key);
             else cpu.releaseKey(key);
         }
@@ -149,6 +234,18 @@ void Chip8::handleSdlInput(SDL_Event &e) {
 }
 void Chip8::handleNcursesInput() {
     int input = getch();
+    // While paused the debugger's command line takes every key except ESC
+    if (debugger && input != ERR && input != 27) {
+        if (debugger->isPaused()) {
+            debugger->typeCharacter(input);
+            return;
+        }
+        if (input == '\t') {
+            debugger->pause("Paused");
+            return;
+        }
+    }
+    if (input != ERR) metrics.keyEvent();
     switch (input) {
         case 27: { // ESC
             int esc_input = getch();
@@ -180,6 +277,99 @@ void Chip8::handleNcursesInput() {
     }
 }
 
+void Chip8::renderSDL(SDL_Renderer *renderer, bool const *const screen) {
+    for (int i = 0; i < SCREEN_SIZE_X*SCREEN_SIZE_Y; i++) {
+        int x = i % SCREEN_SIZE_X;
+        int y = i / SCREEN_SIZE_X;
+        if (screen[i]) SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        else SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        SDL_RenderDrawPoint(renderer, x, y);
+    }
+    SDL_RenderPresent(renderer);
+}
+void Chip8::renderTerminal(bool const *const screen) {
+    for (int i = 0; i < SCREEN_SIZE_X*SCREEN_SIZE_Y; i++) {
+        int x = (i % SCREEN_SIZE_X)*2;
+        int y = i / SCREEN_SIZE_X;
+        if (screen[i]) attron(A_STANDOUT);
+        else attroff(A_STANDOUT);
+        mvprintw(y, x, "  ");
+    }
+    refresh();
+}
+
+void Chip8::clockCpu() {
+    if (!debugger) {
+        cpu.clock();
+        metrics.instructions(1);
+        return;
+    }
+    if (debugger->shouldBreak()) return;
+    cpu.clock(*debugger);
+    metrics.instructions(1);
+    debugger->afterInstruction();
+}
+void Chip8::updateTimers() {
+    if (debugger && debugger->isPaused()) return;
+    cpu.updateTimers();
+}
+
+void Chip8::applySchedulingOptions() {
+    if (!scheduling) return;
+    // Helper threads inherit the cores and policy of the thread creating them, so they are
+    // started (by record() and the frontends' setup) before the main loop is pinned
+    if (recorder) recorder->pinWriter(*scheduling);
+    applyScheduling(*scheduling, this, sizeof(*this));
+}
+
+void Chip8::endFrame() {
+    frameCount++;
+    if (sharedState) sharedState->publish(cpu, screen.data(), frameCount);
+    if (stateDumper) stateDumper->frame(cpu, ram, screen.data(), frameCount);
+    if (recorder) recorder->capture(screen.data());
+}
+
+char const *Chip8::presentFrame(char *status) {
+    if (!metrics.framePresented() || !config.showMetrics) return nullptr;
+    metrics.statusLine(status, METRICS_STATUS_SIZE);
+    return status;
+}
+
+void Chip8::runFrame() {
+    // Same rates as the interactive loops, but driven by emulated rather than host time
+    float const frameTime = 1.0f/config.refreshRate;
+    frameClockAccumulator += frameTime*config.clockSpeed;
+    frameTimerAccumulator += frameTime*60.0f;
+    while (frameTimerAccumulator >= 1.0f) {
+        frameTimerAccumulator -= 1.0f;
+        updateTimers();
+    }
+    if (aotRuntime) {
+        uint64_t instructions = 0;
+        while (frameClockAccumulator >= 1.0f) {
+            frameClockAccumulator -= 1.0f;
+            instructions++;
+        }
+        aotRuntime->run(instructions);
+        metrics.instructions(instructions);
+    } else {
+        while (frameClockAccumulator >= 1.0f) {
+            frameClockAccumulator -= 1.0f;
+            clockCpu();
+        }
+    }
+    endFrame();
+}
+
+void Chip8::runHeadless(uint64_t frames) {
+    struct sigaction action = {};
+    action.sa_handler = requestStop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    applySchedulingOptions();
+    for (uint64_t frame = 0; (frames == 0 || frame < frames) && !stopRequested; frame++) runFrame();
+}
+
 void Chip8::start() {
     if (config.terminalMode) startTerminal();
     else startSDL();
@@ -189,9 +379,13 @@ void Chip8::startSDL() {
     running = true;
 
     SDL_Init(SDL_INIT_TIMER | SDL_INIT_VIDEO | SDL_INIT_EVENTS);
-    SDL_Window *window = SDL_CreateWindow("chip-8", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_SIZE_X*SCREEN_SCALE_FACTOR, SCREEN_SIZE_Y*SCREEN_SCALE_FACTOR, 0);
+    SDL_Window *window = SDL_CreateWindow("chip-8", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, SCREEN_SIZE_X*SCREEN_SCALE_FACTOR, SCREEN_SIZE_Y*SCREEN_SCALE_FACTOR,
+        config.crtEffects ? SDL_WINDOW_RESIZABLE : 0);
     SDL_Renderer *renderer = SDL_CreateRenderer(window, -1, 0);
-    SDL_RenderSetScale(renderer, SCREEN_SCALE_FACTOR, SCREEN_SCALE_FACTOR);
+    // The CRT pipeline upscales to the window itself, the plain renderer lets SDL scale points
+    std::optional<CrtDisplay> crtDisplay;
+    if (config.crtEffects) crtDisplay.emplace(renderer, config);
+    else SDL_RenderSetScale(renderer, SCREEN_SCALE_FACTOR, SCREEN_SCALE_FACTOR);
     SDL_Event e;
 
     // Timings are in seconds
@@ -205,37 +399,45 @@ void Chip8::startSDL() {
     float const sixtyHz = 1.0f/60.0f;
     float const clockSpeed = 1.0f/config.clockSpeed;
     float const refreshRate = 1.0f/config.refreshRate;
+    char title[METRICS_STATUS_SIZE+16] = "chip-8 | ";
+    size_t const titlePrefix = strlen(title);
+    applySchedulingOptions();
 
     while (running) {
         prev = now;
         now = SDL_GetPerformanceCounter();
         deltaTime = (float)((now-prev)/performanceFrequency);
+        metrics.loopIteration(deltaTime*1e9f);
         sixtyHzAccumulator += deltaTime;
         clockAccumulator += deltaTime;
         refreshAccumulator += deltaTime;
 
         handleSdlInput(e);
+        if (sharedState) sharedState->pollKeys(cpu);
 
         if (sixtyHzAccumulator >= sixtyHz) {
             sixtyHzAccumulator -= sixtyHz;
-            cpu.updateTimers();
+            updateTimers();
         }
         if (clockAccumulator >= clockSpeed) {
             clockAccumulator -= clockSpeed;
-            cpu.clock();
+            clockCpu();
         }
         if (refreshAccumulator >= refreshRate) {
             refreshAccumulator -= refreshRate;
-            for (int i = 0; i < SCREEN_SIZE_X*SCREEN_SIZE_Y; i++) {
-                int x = i % SCREEN_SIZE_X;
-                int y = i / SCREEN_SIZE_X;
-                if (screen[i]) SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-                else SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-                SDL_RenderDrawPoint(renderer, x, y);
+            if (debugger) debugger->pollStdin();
+            if (crtDisplay && !crtDisplay->render(screen.data())) {
+                // Reported once, the plain renderer takes over for the rest of the run
+                std::cerr << "Falling back to the plain renderer." << std::endl;
+                crtDisplay.reset();
+                SDL_RenderSetScale(renderer, SCREEN_SCALE_FACTOR, SCREEN_SCALE_FACTOR);
             }
-            SDL_RenderPresent(renderer);
+            if (!crtDisplay) renderSDL(renderer, screen.data());
+            if (presentFrame(title+titlePrefix)) SDL_SetWindowTitle(window, title);
+            endFrame();
         }
     }
+    crtDisplay.reset();
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     SDL_QuitSubSystem(SDL_INIT_TIMER);
@@ -263,36 +465,41 @@ void Chip8::startTerminal() {
     float const sixtyHz = 1.0f/60.0f;
     float const clockSpeed = 1.0f/config.clockSpeed;
     float const refreshRate = 1.0f/config.refreshRate;
+    char status[METRICS_STATUS_SIZE];
+    applySchedulingOptions();
 
     while (running) {
         prev = now;
         now = std::chrono::high_resolution_clock::now();
         std::chrono::duration<float> const elapsed = now - prev;
         float deltaTime = elapsed.count();
+        metrics.loopIteration(std::chrono::duration_cast<std::chrono::nanoseconds>(now-prev).count());
         sixtyHzAccumulator += deltaTime;
         clockAccumulator += deltaTime;
         refreshAccumulator += deltaTime;
 
         handleNcursesInput();
+        if (sharedState) sharedState->pollKeys(cpu);
 
         if (sixtyHzAccumulator >= sixtyHz) {
             sixtyHzAccumulator -= sixtyHz;
-            cpu.updateTimers();
+            updateTimers();
         }
         if (clockAccumulator >= clockSpeed) {
             clockAccumulator -= clockSpeed;
-            cpu.clock();
+            clockCpu();
         }
         if (refreshAccumulator >= refreshRate) {
             refreshAccumulator -= refreshRate;
-            for (int i = 0; i < SCREEN_SIZE_X*SCREEN_SIZE_Y; i++) {
-                int x = (i % SCREEN_SIZE_X)*2;
-                int y = i / SCREEN_SIZE_X;
-                if (screen[i]) attron(A_STANDOUT);
-                else attroff(A_STANDOUT);
-                mvprintw(y, x, "  ");
+            if (debugger) debugger->drawPanel();
+            renderTerminal(screen.data());
+            // Drawn below the screen, shown with the next frame
+            if (presentFrame(status)) {
+                attroff(A_STANDOUT);
+                mvprintw(SCREEN_SIZE_Y, 0, "%s", status);
+                clrtoeol();
             }
-            refresh();
+            endFrame();
         }
     }
     endwin();
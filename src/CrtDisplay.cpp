@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cstring>
+#include "../include/CrtDisplay.hpp"
+#include "../include/Utils.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+    #define CRT_X86_SIMD
+    #include <immintrin.h>
+#endif
+
+#define CRT_SCANLINE_BRIGHTNESS 0.55f   // Brightness of scanline rows relative to the rest
+
+namespace {
+
+void blendScalar(float *intensity, bool const *screen, float decay, size_t n) {
+    for (size_t i = 0; i < n; i++) intensity[i] = screen[i] ? 1.0f : intensity[i]*decay;
+}
+void mapScalar(float const *intensity, uint32_t const *lut, uint32_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = lut[std::min(int(intensity[i]*255.0f+0.5f), 255)];
+}
+void expandScalar(uint32_t const *row, int32_t const *columns, uint32_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = row[columns[i]];
+}
+#ifndef CRT_X86_SIMD
+void copyScalar(uint32_t *dst, uint32_t const *src, size_t n) {
+    std::memcpy(dst, src, n*sizeof(uint32_t));
+}
+#endif
+
+#ifdef CRT_X86_SIMD
+void blendSse2(float *intensity, bool const *screen, float decay, size_t n) {
+    __m128 const vDecay = _mm_set1_ps(decay);
+    __m128 const one = _mm_set1_ps(1.0f);
+    __m128i const zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i+4 <= n; i += 4) {
+        int32_t bytes;
+        std::memcpy(&bytes, screen+i, sizeof(bytes));
+        // Widen 4 bools to 4 32-bit lanes and turn them into a select mask
+        __m128i lit = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+        __m128 mask = _mm_castsi128_ps(_mm_cmpgt_epi32(lit, zero));
+        __m128 decayed = _mm_mul_ps(_mm_loadu_ps(intensity+i), vDecay);
+        _mm_storeu_ps(intensity+i, _mm_or_ps(_mm_and_ps(mask, one), _mm_andnot_ps(mask, decayed)));
+    }
+    blendScalar(intensity+i, screen+i, decay, n-i);
+}
+void mapSse2(float const *intensity, uint32_t const *lut, uint32_t *out, size_t n) {
+    __m128 const scale = _mm_set1_ps(255.0f);
+    __m128 const half = _mm_set1_ps(0.5f);
+    alignas(16) int32_t index[4];
+    size_t i = 0;
+    for (; i+4 <= n; i += 4) {
+        __m128 x = _mm_min_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(intensity+i), scale), half), scale);
+        _mm_store_si128(reinterpret_cast<__m128i *>(index), _mm_cvttps_epi32(x));
+        out[i]   = lut[index[0]];
+        out[i+1] = lut[index[1]];
+        out[i+2] = lut[index[2]];
+        out[i+3] = lut[index[3]];
+    }
+    mapScalar(intensity+i, lut, out+i, n-i);
+}
+void copySse2(uint32_t *dst, uint32_t const *src, size_t n) {
+    size_t i = 0;
+    while (i < n && (reinterpret_cast<uintptr_t>(dst+i) & 15)) { dst[i] = src[i]; i++; }
+    for (; i+4 <= n; i += 4) {
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst+i), _mm_loadu_si128(reinterpret_cast<__m128i const *>(src+i)));
+    }
+    for (; i < n; i++) dst[i] = src[i];
+}
+
+__attribute__((target("avx2"))) void blendAvx2(float *intensity, bool const *screen, float decay, size_t n) {
+    __m256 const vDecay = _mm256_set1_ps(decay);
+    __m256 const one = _mm256_set1_ps(1.0f);
+    __m256i const zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i+8 <= n; i += 8) {
+        __m256i lit = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<__m128i const *>(screen+i)));
+        __m256 mask = _mm256_castsi256_ps(_mm256_cmpgt_epi32(lit, zero));
+        __m256 decayed = _mm256_mul_ps(_mm256_loadu_ps(intensity+i), vDecay);
+        _mm256_storeu_ps(intensity+i, _mm256_blendv_ps(decayed, one, mask));
+    }
+    blendScalar(intensity+i, screen+i, decay, n-i);
+}
+__attribute__((target("avx2"))) void mapAvx2(float const *intensity, uint32_t const *lut, uint32_t *out, size_t n) {
+    __m256 const scale = _mm256_set1_ps(255.0f);
+    __m256 const half = _mm256_set1_ps(0.5f);
+    size_t i = 0;
+    for (; i+8 <= n; i += 8) {
+        __m256 x = _mm256_min_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(intensity+i), scale), half), scale);
+        __m256i colour = _mm256_i32gather_epi32(reinterpret_cast<int const *>(lut), _mm256_cvttps_epi32(x), 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out+i), colour);
+    }
+    mapScalar(intensity+i, lut, out+i, n-i);
+}
+__attribute__((target("avx2"))) void expandAvx2(uint32_t const *row, int32_t const *columns, uint32_t *out, size_t n) {
+    size_t i = 0;
+    for (; i+8 <= n; i += 8) {
+        __m256i index = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(columns+i));
+        __m256i colour = _mm256_i32gather_epi32(reinterpret_cast<int const *>(row), index, 4);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out+i), colour);
+    }
+    expandScalar(row, columns+i, out+i, n-i);
+}
+__attribute__((target("avx2"))) void copyAvx2(uint32_t *dst, uint32_t const *src, size_t n) {
+    size_t i = 0;
+    while (i < n && (reinterpret_cast<uintptr_t>(dst+i) & 31)) { dst[i] = src[i]; i++; }
+    for (; i+8 <= n; i += 8) {
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst+i), _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src+i)));
+    }
+    for (; i < n; i++) dst[i] = src[i];
+}
+#endif
+
+// Foreground and background colours as 0xRRGGBB
+void paletteColours(CrtPalette palette, uint32_t &foreground, uint32_t &background) {
+    switch (palette) {
+        case CrtPalette::Green: foreground = 0x33FF66; background = 0x051008; break;
+        case CrtPalette::Amber: foreground = 0xFFB000; background = 0x100800; break;
+        case CrtPalette::White:
+        default:                foreground = 0xFFFFFF; background = 0x000000; break;
+    }
+}
+uint32_t lerpColour(uint32_t from, uint32_t to, float t, float brightness) {
+    uint32_t colour = 0xFF000000;
+    for (int shift = 0; shift <= 16; shift += 8) {
+        float a = (from >> shift) & 0xFF;
+        float b = (to >> shift) & 0xFF;
+        colour |= uint32_t((a+(b-a)*t)*brightness+0.5f) << shift;
+    }
+    return colour;
+}
+
+} // namespace
+
+CrtDisplay::Kernels CrtDisplay::selectKernels() {
+#ifdef CRT_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {blendAvx2, mapAvx2, expandAvx2, copyAvx2};
+    return {blendSse2, mapSse2, expandScalar, copySse2};
+#else
+    return {blendScalar, mapScalar, expandScalar, copyScalar};
+#endif
+}
+
+CrtDisplay::CrtDisplay(SDL_Renderer *renderer, Chip8Config const &config) :
+    renderer(renderer),
+    texture(nullptr),
+    kernels(selectKernels()),
+    decay(std::clamp(config.phosphorDecay, 0.0f, 1.0f)),
+    scanlines(config.scanlines),
+    width(0),
+    height(0),
+    intensity{0.0f} {
+        TRACE("[CRT: Creating new CrtDisplay " << this << "]");
+        uint32_t foreground, background;
+        paletteColours(config.palette, foreground, background);
+        for (int i = 0; i < 256; i++) {
+            palette[i] = lerpColour(background, foreground, i/255.0f, 1.0f);
+            dimPalette[i] = lerpColour(background, foreground, i/255.0f, CRT_SCANLINE_BRIGHTNESS);
+        }
+    }
+CrtDisplay::~CrtDisplay() {
+    TRACE("[CRT: deleting CrtDisplay " << this << "]");
+    if (texture != nullptr) SDL_DestroyTexture(texture);
+}
+
+void CrtDisplay::resize(int width, int height) {
+    this->width = std::max(width, 1);
+    this->height = std::max(height, 1);
+    columnSource.resize(this->width);
+    for (int x = 0; x < this->width; x++) columnSource[x] = x*SCREEN_SIZE_X/this->width;
+    // Scanlines are only drawn when every emulated row spans at least two output rows;
+    // the bottom third of each emulated row then uses the darkened variant
+    bool const drawScanlines = scanlines && this->height >= SCREEN_SIZE_Y*2;
+    rowSource.resize(this->height);
+    for (int y = 0; y < this->height; y++) {
+        int source = y*SCREEN_SIZE_Y/this->height;
+        bool dim = drawScanlines && (y*SCREEN_SIZE_Y % this->height)*3 >= this->height*2;
+        rowSource[y] = dim ? SCREEN_SIZE_Y+source : source;
+    }
+    scaledRows.assign(size_t(SCREEN_SIZE_Y*2)*this->width, 0);
+}
+
+void CrtDisplay::compose(bool const *const screen, uint32_t *pixels, int pitch) {
+    kernels.blend(intensity.data(), screen, decay, intensity.size());
+    kernels.map(intensity.data(), palette.data(), colours.data(), colours.size());
+    if (scanlines) kernels.map(intensity.data(), dimPalette.data(), dimColours.data(), dimColours.size());
+
+    // Upscale each emulated row horizontally once, then copy it to every output row it covers
+    for (int y = 0; y < SCREEN_SIZE_Y; y++) {
+        kernels.expand(colours.data()+y*SCREEN_SIZE_X, columnSource.data(), scaledRows.data()+size_t(y)*width, width);
+        if (scanlines) {
+            kernels.expand(dimColours.data()+y*SCREEN_SIZE_X, columnSource.data(),
+                scaledRows.data()+size_t(SCREEN_SIZE_Y+y)*width, width);
+        }
+    }
+    for (int y = 0; y < height; y++) {
+        uint32_t *row = reinterpret_cast<uint32_t *>(reinterpret_cast<uint8_t *>(pixels)+size_t(y)*pitch);
+        kernels.copy(row, scaledRows.data()+size_t(rowSource[y])*width, width);
+    }
+#ifdef CRT_X86_SIMD
+    _mm_sfence(); // Order the streaming stores before the texture is handed back to SDL
+#endif
+}
+
+bool CrtDisplay::render(bool const *const screen) {
+    int outputWidth, outputHeight;
+    if (SDL_GetRendererOutputSize(renderer, &outputWidth, &outputHeight) != 0) return true;
+    if (texture == nullptr || outputWidth != width || outputHeight != height) {
+        if (texture != nullptr) SDL_DestroyTexture(texture);
+        resize(outputWidth, outputHeight);
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, width, height);
+        if (texture == nullptr) {
+            std::cerr << "Error! Could not create CRT texture: " << SDL_GetError() << std::endl;
+            return false;
+        }
+    }
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, nullptr, &pixels, &pitch) != 0) return true;
+    compose(screen, static_cast<uint32_t *>(pixels), pitch);
+    SDL_UnlockTexture(texture);
+    SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+    SDL_RenderPresent(renderer);
+    return true;
+}
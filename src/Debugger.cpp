@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <sstream>
+#include <curses.h>
+#include <poll.h>
+#include <unistd.h>
+#include "../include/CpuClock.hpp"
+#include "../include/Debugger.hpp"
+
+std::string disassemble(uint16_t opcode) {
+    char text[32];
+    unsigned int const x = (opcode >> 8) & 0xF;
+    unsigned int const y = (opcode >> 4) & 0xF;
+    unsigned int const n = opcode & 0xF;
+    unsigned int const nn = opcode & 0xFF;
+    unsigned int const nnn = opcode & 0xFFF;
+    switch (opcode >> 12) {
+        case 0x0:
+            if (opcode == 0x00E0) return "CLS";
+            if (opcode == 0x00EE) return "RET";
+            snprintf(text, sizeof(text), "SYS 0x%03X", nnn); break;
+        case 0x1: snprintf(text, sizeof(text), "JP 0x%03X", nnn); break;
+        case 0x2: snprintf(text, sizeof(text), "CALL 0x%03X", nnn); break;
+        case 0x3: snprintf(text, sizeof(text), "SE V%X, 0x%02X", x, nn); break;
+        case 0x4: snprintf(text, sizeof(text), "SNE V%X, 0x%02X", x, nn); break;
+        case 0x5: snprintf(text, sizeof(text), "SE V%X, V%X", x, y); break;
+        case 0x6: snprintf(text, sizeof(text), "LD V%X, 0x%02X", x, nn); break;
+        case 0x7: snprintf(text, sizeof(text), "ADD V%X, 0x%02X", x, nn); break;
+        case 0x8: {
+            static char const *const names[16] = {"LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, "SHL", nullptr};
+            if (names[n] == nullptr) snprintf(text, sizeof(text), "DW 0x%04X", opcode);
+            else snprintf(text, sizeof(text), "%s V%X, V%X", names[n], x, y);
+            break;
+        }
+        case 0x9: snprintf(text, sizeof(text), "SNE V%X, V%X", x, y); break;
+        case 0xA: snprintf(text, sizeof(text), "LD I, 0x%03X", nnn); break;
+        case 0xB: snprintf(text, sizeof(text), "JP V0, 0x%03X", nnn); break;
+        case 0xC: snprintf(text, sizeof(text), "RND V%X, 0x%02X", x, nn); break;
+        case 0xD: snprintf(text, sizeof(text), "DRW V%X, V%X, %u", x, y, n); break;
+        case 0xE:
+            if (nn == 0x9E) snprintf(text, sizeof(text), "SKP V%X", x);
+            else if (nn == 0xA1) snprintf(text, sizeof(text), "SKNP V%X", x);
+            else snprintf(text, sizeof(text), "DW 0x%04X", opcode);
+            break;
+        case 0xF:
+            switch (nn) {
+                case 0x07: snprintf(text, sizeof(text), "LD V%X, DT", x); break;
+                case 0x0A: snprintf(text, sizeof(text), "LD V%X, K", x); break;
+                case 0x15: snprintf(text, sizeof(text), "LD DT, V%X", x); break;
+                case 0x18: snprintf(text, sizeof(text), "LD ST, V%X", x); break;
+                case 0x1E: snprintf(text, sizeof(text), "ADD I, V%X", x); break;
+                case 0x29: snprintf(text, sizeof(text), "LD F, V%X", x); break;
+                case 0x33: snprintf(text, sizeof(text), "LD B, V%X", x); break;
+                case 0x55: snprintf(text, sizeof(text), "LD [I], V%X", x); break;
+                case 0x65: snprintf(text, sizeof(text), "LD V%X, [I]", x); break;
+                default: snprintf(text, sizeof(text), "DW 0x%04X", opcode); break;
+            }
+            break;
+    }
+    return text;
+}
+
+Debugger::Debugger(Cpu const &cpu, std::array<uint8_t, RAM_SIZE> const &ram, bool terminalMode) :
+    cpu(cpu),
+    ram(ram),
+    terminalMode(terminalMode),
+    paused(false),
+    resuming(false),
+    stepsLeft(0),
+    stepOverTarget(-1),
+    watchpointHit(false),
+    watchpoints{0},
+    stdinClosed(false) {
+        TRACE("[DEBUGGER: Creating new Debugger " << this << "]");
+        print(terminalMode ? "Type commands here while paused, Tab pauses, h for help"
+            : "Type commands on stdin, Tab in the window pauses, h for help");
+        pause("Paused before the first instruction");
+    }
+Debugger::~Debugger() { TRACE("[DEBUGGER: deleting Debugger " << this << "]"); }
+
+void Debugger::print(std::string const &line) {
+    if (terminalMode) {
+        log.push_back(line);
+        while (log.size() > DEBUGGER_LOG_LINES) log.pop_front();
+    } else {
+        std::cout << line << "\n";
+    }
+}
+
+void Debugger::hitWatchpoint(uint16_t address, char const *access) {
+    char text[64];
+    // The program counter has already moved past the instruction doing the access
+    snprintf(text, sizeof(text), "Watchpoint: %s of 0x%03X at PC 0x%03X", access, address, cpu.getPc()-2);
+    watchpointHit = true;
+    watchpointEvent = text;
+}
+
+void Debugger::pause(std::string const &reason) {
+    if (paused) return;
+    paused = true;
+    stepsLeft = 0;
+    stepOverTarget = -1;
+    print(reason);
+    if (!terminalMode) {
+        for (std::string const &line : stateLines()) print(line);
+        for (std::string const &line : disassemblyLines(cpu.getPc(), 0, 3)) print(line);
+        std::cout << "(debug) " << std::flush;
+    }
+}
+
+void Debugger::resume(int steps) {
+    paused = false;
+    resuming = true;
+    stepsLeft = steps;
+}
+
+bool Debugger::shouldBreak() {
+    if (paused) return true;
+    uint16_t const pc = cpu.getPc();
+    if (resuming) {
+        resuming = false;
+        return false;
+    }
+    if (pc == stepOverTarget) {
+        pause("Stepped over call");
+        return true;
+    }
+    if (breakpoints.count(pc)) {
+        char text[32];
+        snprintf(text, sizeof(text), "Breakpoint at 0x%03X", pc);
+        pause(text);
+        return true;
+    }
+    return false;
+}
+
+void Debugger::afterInstruction() {
+    if (watchpointHit) {
+        watchpointHit = false;
+        pause(watchpointEvent);
+    } else if (stepsLeft > 0 && --stepsLeft == 0) {
+        stepsLeft = 0;
+        pause("Step");
+    }
+}
+
+std::vector<std::string> Debugger::stateLines() const {
+    std::vector<std::string> lines;
+    char text[96];
+    snprintf(text, sizeof(text), "PC 0x%03X  I 0x%03X  DT %02X  ST %02X  SP %u",
+        cpu.getPc(), cpu.getRegI(), cpu.getDelayTimer(), cpu.getSoundTimer(), cpu.getStackPointer());
+    lines.push_back(text);
+    for (int row = 0; row < 2; row++) {
+        std::string line;
+        for (int i = row*8; i < row*8+8; i++) {
+            snprintf(text, sizeof(text), "V%X %02X ", i, cpu.getRegisters()[i]);
+            line += text;
+        }
+        lines.push_back(line);
+    }
+    std::string stack = "Stack:";
+    for (int i = cpu.getStackPointer()-1; i >= 0; i--) {
+        snprintf(text, sizeof(text), " 0x%03X", cpu.getStack()[i]);
+        stack += text;
+    }
+    lines.push_back(stack);
+    return lines;
+}
+
+std::vector<std::string> Debugger::disassemblyLines(uint16_t address, int before, int after) const {
+    std::vector<std::string> lines;
+    char text[64];
+    for (int i = -before; i <= after; i++) {
+        int at = address+i*2;
+        if (at < 0 || at+1 >= RAM_SIZE) continue;
+        uint16_t opcode = (ram[at] << 8) | ram[at+1];
+        snprintf(text, sizeof(text), "%c%c0x%03X  %04X  %s", at == cpu.getPc() ? '>' : ' ',
+            breakpoints.count(at) ? '*' : ' ', at, opcode, disassemble(opcode).c_str());
+        lines.push_back(text);
+    }
+    return lines;
+}
+
+void Debugger::execute(std::string const &line) {
+    std::istringstream in(line);
+    std::string name;
+    if (!(in >> name)) {
+        if (!terminalMode && paused) std::cout << "(debug) " << std::flush;
+        return;
+    }
+    // Addresses and lengths are hexadecimal, with or without a 0x prefix
+    auto readHex = [&in](unsigned long &value) {
+        std::string token;
+        if (!(in >> token)) return false;
+        try {
+            value = std::stoul(token, nullptr, 16);
+        } catch (...) {
+            return false;
+        }
+        return true;
+    };
+    unsigned long address = 0;
+    unsigned long length = 1;
+
+    if (name == "c" || name == "continue") {
+        resume(0);
+    } else if (name == "s" || name == "step") {
+        unsigned long steps = 1;
+        std::string token;
+        // stepsLeft is an int, larger counts would wrap into a continue or a negative count
+        if (in >> token) steps = std::clamp(std::strtoul(token.c_str(), nullptr, 10), 1ul, (unsigned long)INT_MAX);
+        resume(steps);
+    } else if (name == "n" || name == "next") {
+        uint16_t const pc = cpu.getPc();
+        if ((ram[pc & RAM_ADDRESS_MASK] >> 4) == 0x2) {
+            resume(0);
+            stepOverTarget = pc+2;
+        } else {
+            resume(1);
+        }
+    } else if (name == "p" || name == "pause") {
+        pause("Paused");
+    } else if (name == "b" || name == "break") {
+        if (!readHex(address) || address >= RAM_SIZE) print("Usage: b ADDR");
+        else breakpoints.insert(address);
+    } else if (name == "db") {
+        if (!readHex(address)) print("Usage: db ADDR");
+        else breakpoints.erase(address);
+    } else if (name == "w" || name == "watch" || name == "dw") {
+        uint8_t flags = WATCH_READ | WATCH_WRITE;
+        if (!readHex(address) || address >= RAM_SIZE) {
+            print("Usage: w ADDR [LEN] [r|w|rw], dw ADDR [LEN]");
+        } else {
+            std::string token;
+            while (in >> token) {
+                if (token == "r") flags = WATCH_READ;
+                else if (token == "w") flags = WATCH_WRITE;
+                else if (token == "rw") flags = WATCH_READ | WATCH_WRITE;
+                else length = std::strtoul(token.c_str(), nullptr, 16);
+            }
+            for (unsigned long i = address; i < std::min<unsigned long>(address+length, RAM_SIZE); i++) {
+                if (name == "dw") watchpoints[i] = 0;
+                else watchpoints[i] |= flags;
+            }
+        }
+    } else if (name == "i" || name == "info") {
+        for (std::string const &state : stateLines()) print(state);
+        std::string list = "Breakpoints:";
+        char text[16];
+        for (uint16_t breakpoint : breakpoints) {
+            snprintf(text, sizeof(text), " 0x%03X", breakpoint);
+            list += text;
+        }
+        print(list);
+    } else if (name == "x") {
+        if (!readHex(address) || address >= RAM_SIZE) {
+            print("Usage: x ADDR [LEN]");
+        } else {
+            length = 16;
+            readHex(length);
+            for (unsigned long row = address; row < std::min<unsigned long>(address+length, RAM_SIZE); row += 8) {
+                char text[64];
+                int written = snprintf(text, sizeof(text), "0x%03lX:", row);
+                for (unsigned long i = row; i < std::min<unsigned long>({row+8, address+length, RAM_SIZE}); i++) {
+                    written += snprintf(text+written, sizeof(text)-written, " %02X", ram[i]);
+                }
+                print(text);
+            }
+        }
+    } else if (name == "l" || name == "list") {
+        if (!readHex(address)) address = cpu.getPc();
+        for (std::string const &disassembly : disassemblyLines(address, 4, 4)) print(disassembly);
+    } else if (name == "h" || name == "help") {
+        print("c continue, s [N] step, n next (step over CALL), p pause");
+        print("b/db ADDR (delete) breakpoint, w/dw ADDR [LEN] [r|w|rw] watchpoint");
+        print("i registers and stack, x ADDR [LEN] memory, l [ADDR] disassembly");
+    } else {
+        print("Unknown command " + name + ", h for help");
+    }
+    if (!terminalMode && paused) std::cout << "(debug) " << std::flush;
+}
+
+void Debugger::typeCharacter(int character) {
+    if (character == '\n' || character == KEY_ENTER) {
+        print("> " + command);
+        std::string line = command;
+        command.clear();
+        execute(line);
+    } else if (character == KEY_BACKSPACE || character == 127 || character == '\b') {
+        if (!command.empty()) command.pop_back();
+    } else if (character >= ' ' && character < 127) {
+        command += static_cast<char>(character);
+    }
+}
+
+void Debugger::drawPanel() {
+    int row = 0;
+    attroff(A_STANDOUT);
+    auto line = [&row](std::string const &text) {
+        mvprintw(row++, DEBUGGER_PANEL_X, "%s", text.c_str());
+        clrtoeol();
+    };
+    line(paused ? "DEBUGGER: paused" : "DEBUGGER: running (Tab pauses)");
+    for (std::string const &state : stateLines()) line(state);
+    line("");
+    for (std::string const &disassembly : disassemblyLines(cpu.getPc(), 4, 4)) line(disassembly);
+    line("");
+    for (std::string const &message : log) line(message);
+    for (size_t i = log.size(); i < DEBUGGER_LOG_LINES; i++) line("");
+    line(paused ? "> " + command + "_" : "");
+}
+
+void Debugger::pollStdin() {
+    if (stdinClosed) return;
+    pollfd input = {STDIN_FILENO, POLLIN, 0};
+    while (poll(&input, 1, 0) > 0 && (input.revents & (POLLIN | POLLHUP))) {
+        char buffer[256];
+        ssize_t count = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (count <= 0) {
+            stdinClosed = true;
+            return;
+        }
+        for (ssize_t i = 0; i < count; i++) {
+            if (buffer[i] != '\n') {
+                command += buffer[i];
+                continue;
+            }
+            std::string line = command;
+            command.clear();
+            execute(line);
+        }
+    }
+}
+
+// The debugger runs its own instantiation so that clock() carries no debugging checks
+template void Cpu::clock<Debugger>(Debugger &observer);
@@ -0,0 +1,42 @@
+#include "../include/FrameCodec.hpp"
+
+void packScreen(bool const *const screen, uint8_t *packed) {
+    for (int i = 0; i < PACKED_SCREEN_SIZE; i++) {
+        bool const *pixels = screen+i*8;
+        packed[i] = (pixels[0] << 7) | (pixels[1] << 6) | (pixels[2] << 5) | (pixels[3] << 4)
+            | (pixels[4] << 3) | (pixels[5] << 2) | (pixels[6] << 1) | pixels[7];
+    }
+}
+
+void encodeDelta(uint8_t const *previous, uint8_t const *current, std::vector<uint8_t> &out) {
+    int i = 0;
+    while (i < PACKED_SCREEN_SIZE) {
+        int unchanged = 0;
+        while (i+unchanged < PACKED_SCREEN_SIZE && unchanged < 0xFF && previous[i+unchanged] == current[i+unchanged]) unchanged++;
+        if (i+unchanged == PACKED_SCREEN_SIZE) break; // Nothing left to change
+        i += unchanged;
+        int changed = 0;
+        while (i+changed < PACKED_SCREEN_SIZE && changed < 0xFF && previous[i+changed] != current[i+changed]) changed++;
+        out.push_back(unchanged);
+        out.push_back(changed);
+        for (int j = 0; j < changed; j++) out.push_back(previous[i+j] ^ current[i+j]);
+        i += changed;
+    }
+}
+
+bool applyDelta(uint8_t const *data, size_t size, uint8_t *packed) {
+    size_t offset = 0;
+    int i = 0;
+    while (offset < size) {
+        if (offset+2 > size) return false;
+        int unchanged = data[offset];
+        int changed = data[offset+1];
+        offset += 2;
+        if (i+unchanged+changed > PACKED_SCREEN_SIZE || offset+changed > size) return false;
+        i += unchanged;
+        for (int j = 0; j < changed; j++) packed[i+j] ^= data[offset+j];
+        i += changed;
+        offset += changed;
+    }
+    return true;
+}
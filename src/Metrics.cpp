@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sched.h>
+#include <sys/resource.h>
+#include "../include/Metrics.hpp"
+#include "../include/Utils.hpp"
+
+uint64_t DurationHistogram::percentile(double fraction) const {
+    if (count == 0) return 0;
+    uint64_t const target = (uint64_t)(fraction*(count-1))+1;
+    uint64_t seen = 0;
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= target) return std::min<uint64_t>((uint64_t)(i+1)*METRICS_BUCKET_NS, max);
+    }
+    return max;
+}
+uint64_t DurationHistogram::countFrom(uint64_t duration) const {
+    uint64_t total = 0;
+    for (uint64_t i = std::min<uint64_t>(duration/METRICS_BUCKET_NS, METRICS_BUCKETS-1); i < METRICS_BUCKETS; i++) total += buckets[i];
+    return total;
+}
+
+Metrics::Metrics(uint16_t clockSpeed, uint16_t refreshRate) :
+    framePeriod(refreshRate > 0 ? 1000000000ull/refreshRate : 0),
+    expectedInstructions(refreshRate > 0 ? (float)clockSpeed/refreshRate : 0.0f),
+    start(0),
+    lastFrame(0),
+    frames(0),
+    missedFrames(0),
+    frameInstructions(0),
+    totalInstructions(0),
+    minInstructions(UINT64_MAX),
+    maxInstructions(0),
+    keyTime(0),
+    startContextSwitches(0),
+    contextSwitches(0),
+    lastCpu(-1),
+    migrations(0),
+    statusTime(0),
+    statusFrames(0),
+    statusInstructions(0),
+    statusFps(0.0f),
+    statusInstructionsPerFrame(0.0f) {
+        TRACE("[METRICS: Creating new Metrics " << this << "]");
+    }
+
+uint64_t Metrics::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Metrics::keyEvent() {
+    // Latency is measured from the first event a frame has to answer
+    if (keyTime == 0) keyTime = now();
+}
+
+bool Metrics::framePresented() {
+    uint64_t const time = now();
+    rusage usage = {};
+    getrusage(RUSAGE_THREAD, &usage);
+    int const cpu = sched_getcpu();
+    if (lastCpu >= 0 && cpu != lastCpu) migrations++;
+    lastCpu = cpu;
+    if (start == 0) {
+        start = lastFrame = statusTime = time;
+        startContextSwitches = usage.ru_nivcsw;
+    } else {
+        contextSwitches = usage.ru_nivcsw-startContextSwitches;
+        uint64_t const interval = time-lastFrame;
+        frameTimes.add(interval);
+        // A late frame stands in for every period it overran by at least half
+        if (framePeriod > 0 && interval > framePeriod) missedFrames += (interval+framePeriod/2)/framePeriod-1;
+        lastFrame = time;
+    }
+    if (keyTime != 0) {
+        keyLatencies.add(time-keyTime);
+        keyTime = 0;
+    }
+    frames++;
+    totalInstructions += frameInstructions;
+    if (frameInstructions < minInstructions) minInstructions = frameInstructions;
+    if (frameInstructions > maxInstructions) maxInstructions = frameInstructions;
+    frameInstructions = 0;
+
+    if (time-statusTime < METRICS_STATUS_INTERVAL_NS) return false;
+    float const seconds = (time-statusTime)/1e9f;
+    statusFps = (frames-statusFrames)/seconds;
+    statusInstructionsPerFrame = (float)(totalInstructions-statusInstructions)/(frames-statusFrames);
+    statusTime = time;
+    statusFrames = frames;
+    statusInstructions = totalInstructions;
+    return true;
+}
+
+size_t Metrics::statusLine(char *buffer, size_t size) const {
+    int length = snprintf(buffer, size, "%.1f fps | %.1f/%.1f ipf | frame p50 %.1f p99 %.1f max %.1f ms | missed %llu | key p99 %.1f ms | stalls %llu",
+        statusFps, statusInstructionsPerFrame, expectedInstructions,
+        frameTimes.percentile(0.5)/1e6, frameTimes.percentile(0.99)/1e6, frameTimes.getMax()/1e6,
+        (unsigned long long)missedFrames, keyLatencies.percentile(0.99)/1e6, (unsigned long long)loopGaps.countFrom(METRICS_STALL_NS));
+    if (length < 0) return 0;
+    return std::min<size_t>(length, size > 0 ? size-1 : 0);
+}
+
+void Metrics::report(std::ostream &out) const {
+    double const seconds = frames > 1 ? (lastFrame-start)/1e9 : 0.0;
+    out << "METRICS:\n\tFrames: " << frames << " in " << seconds << " s";
+    if (seconds > 0.0) out << " (" << (frames-1)/seconds << " fps)";
+    out << "\n\tMissed frames: " << missedFrames
+        << "\n\tInstructions per frame: " << (frames > 0 ? (double)totalInstructions/frames : 0.0)
+        << " (requested " << expectedInstructions << ", min " << (frames > 0 ? minInstructions : 0)
+        << ", max " << maxInstructions << ")"
+        << "\n\tFrame time: p50 " << frameTimes.percentile(0.5)/1e6 << " ms, p99 " << frameTimes.percentile(0.99)/1e6
+        << " ms, max " << frameTimes.getMax()/1e6 << " ms (requested " << framePeriod/1e6 << " ms)"
+        << "\n\tKey to present latency: " << keyLatencies.getCount() << " events, p50 " << keyLatencies.percentile(0.5)/1e6
+        << " ms, p99 " << keyLatencies.percentile(0.99)/1e6 << " ms, max " << keyLatencies.getMax()/1e6 << " ms"
+        << "\n\tScheduling: " << loopGaps.countFrom(METRICS_STALL_NS) << " main loop stalls over " << METRICS_STALL_NS/1e6
+        << " ms, longest " << loopGaps.getMax()/1e6 << " ms, " << contextSwitches << " involuntary context switches, "
+        << migrations << " core migrations" << std::endl;
+}
+
+bool Metrics::writeJson(char const *const path) const {
+    std::ofstream file(path);
+    if (!file.good()) {
+        std::cerr << "Error! Could not open metrics file " << path << std::endl;
+        return false;
+    }
+    // Durations in nanoseconds
+    file << "{\"frames\":" << frames
+        << ",\"missed_frames\":" << missedFrames
+        << ",\"frame_period\":" << framePeriod
+        << ",\"instructions\":" << totalInstructions
+        << ",\"instructions_per_frame\":{\"requested\":" << expectedInstructions
+        << ",\"min\":" << (frames > 0 ? minInstructions : 0) << ",\"max\":" << maxInstructions << "}";
+    DurationHistogram const *const histograms[] = {&frameTimes, &keyLatencies};
+    char const *const names[] = {"frame_time", "key_latency"};
+    for (int i = 0; i < 2; i++) {
+        file << ",\"" << names[i] << "\":{\"count\":" << histograms[i]->getCount()
+            << ",\"mean\":" << histograms[i]->getMean()
+            << ",\"p50\":" << histograms[i]->percentile(0.5)
+            << ",\"p99\":" << histograms[i]->percentile(0.99)
+            << ",\"max\":" << histograms[i]->getMax() << "}";
+    }
+    file << ",\"scheduling\":{\"stalls\":" << loopGaps.countFrom(METRICS_STALL_NS)
+        << ",\"longest_gap\":" << loopGaps.getMax()
+        << ",\"involuntary_context_switches\":" << contextSwitches
+        << ",\"migrations\":" << migrations << "}";
+    file << "}" << std::endl;
+    if (!file.good()) {
+        std::cerr << "Error! Could not write metrics file " << path << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../include/Recorder.hpp"
+#include "../include/Utils.hpp"
+
+#define GIF_MIN_CODE_SIZE 2     // Smallest LZW code size GIF allows, enough for a 2-colour image
+#define GIF_MIN_DELAY 2         // Viewers slow down frames shorter than this many 1/100 s
+
+namespace {
+
+inline bool pixelAt(uint8_t const *packed, int x, int y) {
+    int const i = y*SCREEN_SIZE_X+x;
+    return (packed[i >> 3] >> (7-(i & 7))) & 0x01;
+}
+inline void putU16(std::vector<uint8_t> &out, uint16_t value) {
+    out.push_back(value & 0xFF);
+    out.push_back(value >> 8);
+}
+
+} // namespace
+
+RecordFormat recordFormatForPath(char const *const path) {
+    char const *extension = strrchr(path, '.');
+    if (extension != nullptr && strcasecmp(extension, ".y4m") == 0) return RecordFormat::Y4m;
+    if (extension != nullptr && strcasecmp(extension, ".gif") == 0) return RecordFormat::Gif;
+    return RecordFormat::Raw;
+}
+
+Recorder::Recorder(RecordFormat format, unsigned int scale, uint16_t frameRate) :
+    format(format),
+    scale(scale),
+    frameRate(frameRate),
+    fd(-1),
+    failed(false),
+    ring(RECORDER_RING_SIZE),
+    head(0),
+    tail(0),
+    stopping(false),
+    row(SCREEN_SIZE_X*scale),
+    framesEncoded(0),
+    gifPending{0},
+    gifShown{0},
+    gifPendingStart(0),
+    gifHasPending(false),
+    gifCodes(GIF_MAX_CODES),
+    gifPixels(SCREEN_SIZE_X*SCREEN_SIZE_Y*scale*scale) {
+        TRACE("[REC: Creating new Recorder " << this << "]");
+        out.reserve(RECORDER_FLUSH_SIZE+SCREEN_SIZE_X*SCREEN_SIZE_Y*scale*scale*2);
+        // Y4M takes one byte per output pixel, raw one bit
+        rowBytesPerByte = format == RecordFormat::Y4m ? 8*scale : scale;
+        expansion.assign(256*rowBytesPerByte, 0);
+        for (int value = 0; value < 256; value++) {
+            uint8_t *const bytes = expansion.data()+value*rowBytesPerByte;
+            for (unsigned int i = 0; i < 8*scale; i++) {
+                bool const lit = (value >> (7-i/scale)) & 0x01;
+                if (format == RecordFormat::Y4m) bytes[i] = lit ? 235 : 16; // Video range, which players expect
+                else if (lit) bytes[i >> 3] |= 0x80 >> (i & 7);
+            }
+        }
+    }
+Recorder::~Recorder() {
+    TRACE("[REC: deleting Recorder " << this << "]");
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        condition.notify_all();
+        writer.join();
+        finish();
+        flush();
+    }
+    if (fd >= 0) close(fd);
+}
+
+bool Recorder::open(char const *const path) {
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error! Could not open recording " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (format == RecordFormat::Y4m) {
+        char header[96];
+        int size = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 Cmono\n",
+            SCREEN_SIZE_X*scale, SCREEN_SIZE_Y*scale, frameRate);
+        out.insert(out.end(), header, header+size);
+    } else if (format == RecordFormat::Gif) {
+        writeGifHeader();
+    }
+    writer = std::thread([this] { writerLoop(); });
+    return true;
+}
+
+void Recorder::capture(bool const *const screen) {
+    if (fd < 0) return;
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this] { return head-tail < RECORDER_RING_SIZE; });
+    // The writer never touches slots at or after head, so pack without holding the lock
+    uint8_t *slot = ring[head % RECORDER_RING_SIZE].data();
+    lock.unlock();
+    packScreen(screen, slot);
+    lock.lock();
+    head++;
+    lock.unlock();
+    condition.notify_all();
+}
+
+void Recorder::writerLoop() {
+    while (true) {
+        uint64_t first, last;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return stopping || tail < head; });
+            if (tail == head) return; // Stopping and nothing left
+            first = tail;
+            last = head;
+        }
+        for (uint64_t frame = first; frame < last; frame++) encode(ring[frame % RECORDER_RING_SIZE].data());
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tail = last;
+        }
+        condition.notify_all();
+        if (out.size() >= RECORDER_FLUSH_SIZE) flush();
+    }
+}
+
+void Recorder::encode(uint8_t const *packed) {
+    if (!failed) {
+        switch (format) {
+            case RecordFormat::Y4m: encodeY4m(packed); break;   // Same rows, one byte per pixel
+            case RecordFormat::Raw: encodeRaw(packed); break;
+            case RecordFormat::Gif: encodeGif(packed); break;
+        }
+    }
+    framesEncoded++;
+}
+
+void Recorder::encodeY4m(uint8_t const *packed) {
+    static char const frameHeader[] = "FRAME\n";
+    out.insert(out.end(), frameHeader, frameHeader+sizeof(frameHeader)-1);
+    encodeRaw(packed);
+}
+
+void Recorder::encodeRaw(uint8_t const *packed) {
+    int const packedRow = SCREEN_SIZE_X/8;
+    for (int y = 0; y < SCREEN_SIZE_Y; y++) {
+        uint8_t *bytes = row.data();
+        for (int i = 0; i < packedRow; i++) {
+            bytes = std::copy_n(expansion.begin()+packed[y*packedRow+i]*rowBytesPerByte, rowBytesPerByte, bytes);
+        }
+        for (unsigned int i = 0; i < scale; i++) out.insert(out.end(), row.data(), bytes);
+    }
+}
+
+void Recorder::writeGifHeader() {
+    static uint8_t const signature[] = {'G', 'I', 'F', '8', '9', 'a'};
+    out.insert(out.end(), signature, signature+sizeof(signature));
+    putU16(out, SCREEN_SIZE_X*scale);
+    putU16(out, SCREEN_SIZE_Y*scale);
+    out.push_back(0x80);    // 2-entry global colour table
+    out.push_back(0);       // Background colour index
+    out.push_back(0);       // No pixel aspect ratio
+    static uint8_t const palette[] = {0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF};
+    out.insert(out.end(), palette, palette+sizeof(palette));
+    // Loop forever
+    static uint8_t const loop[] = {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 0x03, 0x01, 0x00, 0x00, 0x00};
+    out.insert(out.end(), loop, loop+sizeof(loop));
+}
+
+void Recorder::encodeGif(uint8_t const *packed) {
+    uint64_t const frame = framesEncoded;
+    if (!gifHasPending) {
+        std::copy_n(packed, PACKED_SCREEN_SIZE, gifPending.begin());
+        gifPendingStart = frame;
+        gifHasPending = true;
+        return;
+    }
+    if (std::equal(packed, packed+PACKED_SCREEN_SIZE, gifPending.begin())) return;
+    // The pending frame lasted until now. Frames too short for GIF timing are
+    // dropped, and the new frame takes over their start time
+    if (frame*100/frameRate - gifPendingStart*100/frameRate >= GIF_MIN_DELAY) {
+        writeGifFrame(gifPending.data(), gifPendingStart, frame);
+        gifPendingStart = frame;
+    }
+    std::copy_n(packed, PACKED_SCREEN_SIZE, gifPending.begin());
+}
+
+void Recorder::writeGifFrame(uint8_t const *packed, uint64_t start, uint64_t end) {
+    // Only store the rectangle that changed since the last frame written
+    int left = SCREEN_SIZE_X, right = -1, top = SCREEN_SIZE_Y, bottom = -1;
+    for (int i = 0; i < PACKED_SCREEN_SIZE; i++) {
+        uint8_t const changed = packed[i] ^ gifShown[i];
+        if (changed == 0) continue;
+        int const x = (i*8) % SCREEN_SIZE_X;
+        int const y = (i*8) / SCREEN_SIZE_X;
+        left = std::min(left, x+__builtin_clz(changed)-24);
+        right = std::max(right, x+7-__builtin_ctz(changed));
+        top = std::min(top, y);
+        bottom = y;
+    }
+    if (right < 0) left = right = top = bottom = 0; // Nothing changed, the frame only carries time
+    std::copy_n(packed, PACKED_SCREEN_SIZE, gifShown.begin());
+
+    uint64_t const delay = std::max<uint64_t>(end*100/frameRate - start*100/frameRate, GIF_MIN_DELAY);
+    static uint8_t const control[] = {0x21, 0xF9, 0x04, 0x04};     // Graphic control: keep the frame under the next one
+    out.insert(out.end(), control, control+sizeof(control));
+    putU16(out, std::min<uint64_t>(delay, 0xFFFF));
+    out.push_back(0);       // No transparent colour
+    out.push_back(0);
+
+    int const width = (right-left+1)*scale;
+    int const height = (bottom-top+1)*scale;
+    out.push_back(0x2C);    // Image descriptor
+    putU16(out, left*scale);
+    putU16(out, top*scale);
+    putU16(out, width);
+    putU16(out, height);
+    out.push_back(0);       // No local colour table, not interlaced
+
+    uint8_t *pixels = gifPixels.data();
+    for (int y = top; y <= bottom; y++) {
+        uint8_t *const rowStart = pixels;
+        for (int x = left; x <= right; x++) pixels = std::fill_n(pixels, scale, pixelAt(packed, x, y));
+        for (unsigned int i = 1; i < scale; i++) pixels = std::copy(rowStart, rowStart+width, pixels);
+    }
+    writeGifLzw(width, height);
+}
+
+void Recorder::writeGifLzw(int width, int height) {
+    int const clearCode = 1 << GIF_MIN_CODE_SIZE;
+    int const endCode = clearCode+1;
+    out.push_back(GIF_MIN_CODE_SIZE);
+
+    // Codes are packed least significant bit first into sub-blocks of up to 255 bytes
+    uint8_t block[255];
+    int blockSize = 0;
+    uint32_t bits = 0;
+    int bitCount = 0;
+    auto emit = [&](int code, int size) {
+        bits |= code << bitCount;
+        bitCount += size;
+        while (bitCount >= 8) {
+            block[blockSize++] = bits & 0xFF;
+            bits >>= 8;
+            bitCount -= 8;
+            if (blockSize == sizeof(block)) {
+                out.push_back(blockSize);
+                out.insert(out.end(), block, block+blockSize);
+                blockSize = 0;
+            }
+        }
+    };
+
+    int codeSize = GIF_MIN_CODE_SIZE+1;
+    int maxCode = endCode;
+    std::fill(gifCodes.begin(), gifCodes.end(), std::array<int16_t, 2>{-1, -1});
+    emit(clearCode, codeSize);
+    uint8_t const *pixels = gifPixels.data();
+    size_t const count = (size_t)width*height;
+    int prefix = pixels[0];
+    for (size_t i = 1; i < count; i++) {
+        int const pixel = pixels[i];
+        if (gifCodes[prefix][pixel] >= 0) {
+            prefix = gifCodes[prefix][pixel];
+            continue;
+        }
+        emit(prefix, codeSize);
+        gifCodes[prefix][pixel] = ++maxCode;
+        if (maxCode >= (1 << codeSize)) codeSize++;
+        if (maxCode == GIF_MAX_CODES-1) {
+            emit(clearCode, codeSize);
+            std::fill(gifCodes.begin(), gifCodes.end(), std::array<int16_t, 2>{-1, -1});
+            codeSize = GIF_MIN_CODE_SIZE+1;
+            maxCode = endCode;
+        }
+        prefix = pixel;
+    }
+    emit(prefix, codeSize);
+    emit(endCode, codeSize);
+    if (bitCount > 0) emit(0, 8-bitCount);
+    if (blockSize > 0) {
+        out.push_back(blockSize);
+        out.insert(out.end(), block, block+blockSize);
+    }
+    out.push_back(0);       // Block terminator
+}
+
+void Recorder::finish() {
+    if (failed || format != RecordFormat::Gif) return;
+    if (gifHasPending) writeGifFrame(gifPending.data(), gifPendingStart, framesEncoded);
+    out.push_back(0x3B);    // Trailer
+}
+
+void Recorder::flush() {
+    size_t offset = 0;
+    while (!failed && offset < out.size()) {
+        ssize_t written = write(fd, out.data()+offset, out.size()-offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error! Could not write recording: " << strerror(errno) << std::endl;
+            failed = true;
+        } else {
+            offset += written;
+        }
+    }
+    out.clear();
+}
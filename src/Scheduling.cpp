@@ -0,0 +1,76 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "../include/Scheduling.hpp"
+#include "../include/Utils.hpp"
+
+bool parseCpuList(char const *const text, cpu_set_t &cpus) {
+    CPU_ZERO(&cpus);
+    char const *position = text;
+    while (true) {
+        char *end;
+        long first = std::strtol(position, &end, 10);
+        if (end == position || first < 0) return false;
+        long last = first;
+        if (*end == '-') {
+            position = end+1;
+            last = std::strtol(position, &end, 10);
+            if (end == position || last < first) return false;
+        }
+        if (last >= CPU_SETSIZE) return false;
+        for (long cpu = first; cpu <= last; cpu++) CPU_SET(cpu, &cpus);
+        if (*end == '\0') return true;
+        if (*end != ',') return false;
+        position = end+1;
+    }
+}
+
+bool applyScheduling(SchedulingOptions const &options, void const *state, size_t stateSize) {
+    bool applied = true;
+    if (options.pin) {
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(options.cpus), &options.cpus);
+        if (error != 0) {
+            std::cerr << "Error! Could not pin the emulation thread to the requested cores: " << strerror(error) << std::endl;
+            applied = false;
+        }
+    }
+    // On Linux a nice level set with a thread's id of 0 only applies to that thread
+    if (options.setNice && setpriority(PRIO_PROCESS, 0, options.nice) != 0) {
+        std::cerr << "Error! Could not set nice level " << options.nice << ": " << strerror(errno) << std::endl;
+        applied = false;
+    }
+    if (options.realtimePriority > 0) {
+        sched_param parameters = {};
+        parameters.sched_priority = options.realtimePriority;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &parameters);
+        if (error != 0) {
+            std::cerr << "Error! Could not use SCHED_FIFO priority " << options.realtimePriority << ": " << strerror(error)
+                << " (needs CAP_SYS_NICE or an RLIMIT_RTPRIO)" << std::endl;
+            applied = false;
+        }
+    }
+    if (options.lockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        // Usually RLIMIT_MEMLOCK, which still leaves room for the machine state
+        int const error = errno;
+        if (mlock(state, stateSize) != 0) {
+            std::cerr << "Error! Could not lock memory: " << strerror(error) << std::endl;
+            applied = false;
+        } else {
+            std::cerr << "Could not lock all memory (" << strerror(error) << "), locked the machine state only" << std::endl;
+        }
+    }
+    return applied;
+}
+
+void pinHelperThread(pthread_t thread, SchedulingOptions const &options) {
+    if (!options.pin) return;
+    // The helper still has the cores it inherited, before the emulation thread was pinned
+    cpu_set_t allowed;
+    if (pthread_getaffinity_np(thread, sizeof(allowed), &allowed) != 0) return;
+    cpu_set_t helpers;
+    CPU_XOR(&helpers, &allowed, &options.cpus);
+    CPU_AND(&helpers, &helpers, &allowed);
+    if (CPU_COUNT(&helpers) > 0) pthread_setaffinity_np(thread, sizeof(helpers), &helpers);
+}
@@ -0,0 +1,445 @@
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "../include/Server.hpp"
+
+namespace {
+
+volatile sig_atomic_t stopRequested = 0;
+void requestStop(int) { stopRequested = 1; }
+
+void putU32(uint8_t *out, uint32_t value) {
+    for (int i = 0; i < 4; i++) out[i] = (value >> (8*i)) & 0xFF;
+}
+void putU64(uint8_t *out, uint64_t value) {
+    for (int i = 0; i < 8; i++) out[i] = (value >> (8*i)) & 0xFF;
+}
+uint32_t getU32(uint8_t const *in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | (uint32_t(in[3]) << 24);
+}
+void writeHeader(uint8_t *out, ServerMessage type, uint32_t sessionId, uint32_t size) {
+    out[0] = static_cast<uint8_t>(type);
+    putU32(out+1, sessionId);
+    putU32(out+5, size);
+}
+
+} // namespace
+
+Server::ThreadPool::ThreadPool(unsigned int threadCount) : stopping(false) {
+    for (unsigned int i = 0; i < threadCount; i++) {
+        workers.emplace_back([this] {
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+                    if (stopping && tasks.empty()) return;
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        });
+    }
+}
+Server::ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    for (std::thread &worker : workers) worker.join();
+}
+void Server::ThreadPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push_back(std::move(task));
+    }
+    condition.notify_one();
+}
+
+Server::Server(Chip8Config const config) :
+    config(config),
+    listenFd(-1),
+    epollFd(-1),
+    timerFd(-1),
+    wakeFd(-1),
+    nextSessionId(1) {
+        TRACE("[SERVER: Creating new Server " << this << "]");
+    }
+Server::~Server() {
+    TRACE("[SERVER: deleting Server " << this << "]");
+    pool.reset(); // Workers reference the server, so let in-flight frames finish first
+    for (auto &[fd, connection] : connections) close(fd);
+    if (listenFd >= 0) close(listenFd);
+    if (epollFd >= 0) close(epollFd);
+    if (timerFd >= 0) close(timerFd);
+    if (wakeFd >= 0) close(wakeFd);
+    if (!unixPath.empty()) unlink(unixPath.c_str());
+}
+
+bool Server::listen(char const *const address) {
+    if (strncmp(address, "unix:", 5) == 0) {
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (strlen(address+5) >= sizeof(addr.sun_path)) {
+            std::cerr << "Error! Unix socket path " << address+5 << " is too long" << std::endl;
+            return false;
+        }
+        strcpy(addr.sun_path, address+5);
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        unlink(addr.sun_path);
+        if (listenFd < 0 || bind(listenFd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+            std::cerr << "Error! Could not bind to " << address << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        unixPath = addr.sun_path;
+    } else {
+        std::string host = "127.0.0.1";
+        std::string port = address;
+        size_t colon = port.rfind(':');
+        if (colon != std::string::npos) {
+            host = port.substr(0, colon);
+            port = port.substr(colon+1);
+        }
+        addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        addrinfo *result = nullptr;
+        int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result);
+        if (error != 0) {
+            std::cerr << "Error! Invalid address " << address << ": " << gai_strerror(error) << std::endl;
+            return false;
+        }
+        for (addrinfo *info = result; info != nullptr; info = info->ai_next) {
+            listenFd = socket(info->ai_family, info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, info->ai_protocol);
+            if (listenFd < 0) continue;
+            int enable = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+            if (bind(listenFd, info->ai_addr, info->ai_addrlen) == 0) break;
+            close(listenFd);
+            listenFd = -1;
+        }
+        freeaddrinfo(result);
+        if (listenFd < 0) {
+            std::cerr << "Error! Could not bind to " << address << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    if (::listen(listenFd, SOMAXCONN) != 0) {
+        std::cerr << "Error! Could not listen on " << address << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epollFd < 0 || timerFd < 0 || wakeFd < 0) {
+        std::cerr << "Error! Could not set up the event loop: " << strerror(errno) << std::endl;
+        return false;
+    }
+    long const framePeriod = 1000000000L/config.refreshRate;
+    itimerspec interval = {{framePeriod/1000000000L, framePeriod%1000000000L}, {framePeriod/1000000000L, framePeriod%1000000000L}};
+    timerfd_settime(timerFd, 0, &interval, nullptr);
+    for (int fd : {listenFd, timerFd, wakeFd}) {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+    }
+
+    pool = std::make_unique<ThreadPool>(std::max(1u, std::thread::hardware_concurrency()));
+    std::clog << "Serving on " << address << std::endl;
+    return true;
+}
+
+void Server::run() {
+    struct sigaction action = {};
+    action.sa_handler = requestStop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);    // No SA_RESTART, so epoll_wait is interrupted
+    sigaction(SIGTERM, &action, nullptr);
+
+    std::array<epoll_event, 64> events;
+    while (!stopRequested) {
+        int count = epoll_wait(epollFd, events.data(), events.size(), -1);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error! epoll_wait failed: " << strerror(errno) << std::endl;
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listenFd) {
+                acceptClients();
+            } else if (fd == timerFd) {
+                uint64_t expirations;
+                if (read(timerFd, &expirations, sizeof(expirations)) > 0) tick();
+            } else if (fd == wakeFd) {
+                uint64_t value;
+                if (read(wakeFd, &value, sizeof(value)) > 0) collectFrames();
+            } else {
+                auto it = connections.find(fd);
+                if (it == connections.end()) continue;
+                Connection &connection = *it->second;
+                bool open = !(events[i].events & (EPOLLERR | EPOLLHUP));
+                if (open && (events[i].events & (EPOLLIN | EPOLLRDHUP))) open = readClient(connection);
+                if (open && (events[i].events & EPOLLOUT)) open = flush(connection);
+                if (!open) closeClient(fd);
+            }
+        }
+    }
+}
+
+void Server::acceptClients() {
+    while (true) {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) std::cerr << "Error! accept failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        int enable = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)); // Fails harmlessly on Unix sockets
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLRDHUP;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        connections[fd] = std::make_unique<Connection>(fd);
+    }
+}
+
+bool Server::readClient(Connection &connection) {
+    uint8_t buffer[16384];
+    bool closed = false;    // The client shut down its side, answer what it sent before closing
+    while (true) {
+        ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (received > 0) connection.in.insert(connection.in.end(), buffer, buffer+received);
+        else if (received == 0) {
+            closed = true;
+            break;
+        }
+        else if (errno == EINTR) continue;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        else return false;
+    }
+
+    size_t offset = 0;
+    while (connection.in.size()-offset >= SERVER_HEADER_SIZE) {
+        uint8_t const *header = connection.in.data()+offset;
+        uint32_t size = getU32(header+5);
+        if (size > SERVER_MAX_PAYLOAD) {
+            char const message[] = "Message too large";
+            send(connection, ServerMessage::Error, getU32(header+1), reinterpret_cast<uint8_t const *>(message), sizeof(message)-1);
+            flush(connection);
+            return false;
+        }
+        if (connection.in.size()-offset-SERVER_HEADER_SIZE < size) break;
+        handleMessage(connection, static_cast<ServerMessage>(header[0]), getU32(header+1), header+SERVER_HEADER_SIZE, size);
+        offset += SERVER_HEADER_SIZE+size;
+    }
+    connection.in.erase(connection.in.begin(), connection.in.begin()+offset);
+    return flush(connection) && !closed;
+}
+
+void Server::closeClient(int fd) {
+    auto it = connections.find(fd);
+    if (it == connections.end()) return;
+    // Workers still running a frame keep their session alive until they are done
+    for (uint32_t id : it->second->sessions) sessions.erase(id);
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    connections.erase(it);
+}
+
+void Server::handleMessage(Connection &connection, ServerMessage type, uint32_t sessionId, uint8_t const *payload, uint32_t size) {
+    auto error = [&](char const *message) {
+        send(connection, ServerMessage::Error, sessionId, reinterpret_cast<uint8_t const *>(message), strlen(message));
+    };
+    if (type == ServerMessage::Create) {
+        uint32_t id = nextSessionId++;
+        sessions[id] = std::make_shared<Session>(id, connection.fd);
+        connection.sessions.push_back(id);
+        send(connection, ServerMessage::Created, id, nullptr, 0);
+        return;
+    }
+
+    auto it = sessions.find(sessionId);
+    if (it == sessions.end() || it->second->connectionFd != connection.fd) {
+        error("Unknown session");
+        return;
+    }
+    Session &session = *it->second;
+    switch (type) {
+        case ServerMessage::LoadRom: {
+            Chip8Config sessionConfig = config;
+            sessionConfig.terminalMode = false;
+            std::unique_ptr<Chip8> chip8 = std::make_unique<Chip8>(sessionConfig);
+            if (!chip8->loadRom(payload, size)) {
+                error("ROM is too large");
+                return;
+            }
+            std::lock_guard<std::mutex> lock(session.mutex);
+            session.chip8 = std::move(chip8);
+            session.running = true;
+            session.lastSent.fill(0);
+            session.outgoing.clear();
+            send(connection, ServerMessage::Ok, sessionId, nullptr, 0);
+            break;
+        }
+        case ServerMessage::Key: {
+            if (size < 2) {
+                error("Key message requires a key and a state");
+                return;
+            }
+            std::lock_guard<std::mutex> lock(session.mutex);
+            if (!session.chip8) return;
+            if (payload[1]) session.chip8->pressKey(payload[0]);
+            else session.chip8->releaseKey(payload[0]);
+            break;
+        }
+        case ServerMessage::Subscribe: {
+            // Frames encoded before this point were against the old screen, so drop them
+            // and restart from an all-off screen; the Ok marks the restart in the stream
+            std::lock_guard<std::mutex> lock(session.mutex);
+            session.subscribed = size > 0 && payload[0];
+            session.lastSent.fill(0);
+            session.outgoing.clear();
+            send(connection, ServerMessage::Ok, sessionId, nullptr, 0);
+            break;
+        }
+        case ServerMessage::Destroy:
+            sessions.erase(it);
+            connection.sessions.erase(std::remove(connection.sessions.begin(), connection.sessions.end(), sessionId), connection.sessions.end());
+            send(connection, ServerMessage::Ok, sessionId, nullptr, 0);
+            break;
+        default:
+            error("Unknown message type");
+            break;
+    }
+}
+
+void Server::tick() {
+    for (auto &[id, session] : sessions) {
+        // A session still busy with its previous frame skips this one rather than queueing up
+        if (session->busy.exchange(true)) continue;
+        pool->submit([this, session] { runSession(session); });
+    }
+}
+
+void Server::runSession(std::shared_ptr<Session> session) {
+    bool hasOutput = false;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (session->running) {
+            session->chip8->runFrame();
+            if (session->subscribed && !session->congested.load(std::memory_order_relaxed)) {
+                std::array<uint8_t, PACKED_SCREEN_SIZE> packed;
+                packScreen(session->chip8->getScreen().data(), packed.data());
+                std::vector<uint8_t> &out = session->outgoing;
+                size_t const start = out.size();
+                out.resize(start+SERVER_HEADER_SIZE+8);
+                encodeDelta(session->lastSent.data(), packed.data(), out);
+                uint32_t size = out.size()-start-SERVER_HEADER_SIZE;
+                if (size == 8) {
+                    out.resize(start); // Nothing changed, send nothing
+                } else {
+                    writeHeader(out.data()+start, ServerMessage::Frame, session->id, size);
+                    putU64(out.data()+start+SERVER_HEADER_SIZE, session->chip8->getFrameCount());
+                    session->lastSent = packed;
+                    hasOutput = true;
+                }
+            }
+        }
+    }
+    session->busy.store(false);
+    if (!hasOutput) return;
+
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        wake = ready.empty(); // Only the first ready session of a batch needs to wake the loop
+        ready.push_back(session->id);
+    }
+    if (wake) {
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0) std::cerr << "Error! Could not wake the event loop" << std::endl;
+    }
+}
+
+void Server::collectFrames() {
+    std::vector<uint32_t> ids;
+    {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        ids.swap(ready);
+    }
+    std::vector<int> touched;
+    for (uint32_t id : ids) {
+        auto session = sessions.find(id);
+        if (session == sessions.end()) continue;
+        auto connection = connections.find(session->second->connectionFd);
+        if (connection == connections.end()) continue;
+        std::lock_guard<std::mutex> lock(session->second->mutex);
+        std::vector<uint8_t> &outgoing = session->second->outgoing;
+        if (outgoing.empty()) continue;
+        std::vector<uint8_t> &out = connection->second->out;
+        out.insert(out.end(), outgoing.begin(), outgoing.end());
+        outgoing.clear();
+        touched.push_back(connection->first);
+    }
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    for (int fd : touched) {
+        if (!flush(*connections[fd])) closeClient(fd);
+    }
+}
+
+void Server::send(Connection &connection, ServerMessage type, uint32_t sessionId, uint8_t const *payload, uint32_t size) {
+    size_t const start = connection.out.size();
+    connection.out.resize(start+SERVER_HEADER_SIZE+size);
+    writeHeader(connection.out.data()+start, type, sessionId, size);
+    if (size > 0) std::memcpy(connection.out.data()+start+SERVER_HEADER_SIZE, payload, size);
+}
+
+bool Server::flush(Connection &connection) {
+    while (connection.outOffset < connection.out.size()) {
+        ssize_t sent = ::send(connection.fd, connection.out.data()+connection.outOffset,
+            connection.out.size()-connection.outOffset, MSG_NOSIGNAL);
+        if (sent > 0) connection.outOffset += sent;
+        else if (sent < 0 && errno == EINTR) continue;
+        else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        else return false;
+    }
+    if (connection.outOffset == connection.out.size()) {
+        connection.out.clear();
+        connection.outOffset = 0;
+    }
+
+    // Only ask for EPOLLOUT while there is something left to send
+    bool const pending = !connection.out.empty();
+    if (pending != connection.waitingWritable) {
+        epoll_event event = {};
+        event.events = EPOLLIN | EPOLLRDHUP | (pending ? (uint32_t)EPOLLOUT : 0u);
+        event.data.fd = connection.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.waitingWritable = pending;
+    }
+
+    bool const congested = connection.out.size()-connection.outOffset > SERVER_MAX_BACKLOG;
+    for (uint32_t id : connection.sessions) {
+        auto session = sessions.find(id);
+        if (session != sessions.end()) session->second->congested.store(congested, std::memory_order_relaxed);
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../include/SharedState.hpp"
+
+SharedState::SharedState() :
+    fd(-1),
+    segment(nullptr),
+    appliedKeys(0) {
+        TRACE("[SHM: Creating new SharedState " << this << "]");
+    }
+SharedState::~SharedState() {
+    TRACE("[SHM: deleting SharedState " << this << "]");
+    if (segment != nullptr) munmap(segment, sizeof(SharedSegment));
+    if (fd >= 0) {
+        close(fd);
+        shm_unlink(name.c_str());
+    }
+}
+
+bool SharedState::open(char const *const name) {
+    this->name = name[0] == '/' ? name : std::string("/")+name;
+    // Never take over a segment another emulator may still be publishing to
+    fd = shm_open(this->name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        std::cerr << "Error! Shared memory " << this->name << " already exists, another emulator may be using it. "
+            "If none is, remove /dev/shm" << this->name << std::endl;
+        return false;
+    }
+    if (fd < 0) {
+        std::cerr << "Error! Could not open shared memory " << this->name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, sizeof(SharedSegment)) != 0) {
+        std::cerr << "Error! Could not resize shared memory " << this->name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    void *memory = mmap(nullptr, sizeof(SharedSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        std::cerr << "Error! Could not map shared memory " << this->name << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    segment = static_cast<SharedSegment *>(memory);
+    // Readers check the magic last, so publish it after everything else is in place
+    segment->version = SHARED_STATE_VERSION;
+    segment->size = sizeof(SharedSegment);
+    segment->sequence.store(0, std::memory_order_relaxed);
+    segment->keys.store(0, std::memory_order_relaxed);
+    std::memset(&segment->frame, 0, sizeof(segment->frame));
+    std::atomic_thread_fence(std::memory_order_release);
+    segment->magic = SHARED_STATE_MAGIC;
+    return true;
+}
+
+void SharedState::publish(Cpu const &cpu, bool const *const screen, uint64_t frame) {
+    if (segment == nullptr) return;
+    uint32_t sequence = segment->sequence.load(std::memory_order_relaxed);
+    segment->sequence.store(sequence+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    SharedFrame &out = segment->frame;
+    out.frame = frame;
+    // bool is one byte holding 0 or 1, which is exactly the published pixel format
+    std::memcpy(out.screen, screen, sizeof(out.screen));
+    std::memcpy(out.reg, cpu.getRegisters().data(), sizeof(out.reg));
+    out.pc = cpu.getPc();
+    out.regI = cpu.getRegI();
+    std::memcpy(out.stack, cpu.getStack().data(), sizeof(out.stack));
+    out.stackPointer = cpu.getStackPointer();
+    out.delayTimer = cpu.getDelayTimer();
+    out.soundTimer = cpu.getSoundTimer();
+
+    segment->sequence.store(sequence+2, std::memory_order_release);
+}
+
+void SharedState::pollKeys(Cpu &cpu) {
+    if (segment == nullptr) return;
+    uint16_t keys = segment->keys.load(std::memory_order_acquire);
+    uint16_t changed = keys ^ appliedKeys;
+    if (changed == 0) return;
+    for (uint8_t key = 0; key <= 0xF; key++) {
+        if (!((changed >> key) & 1)) continue;
+        if ((keys >> key) & 1) cpu.pressKey(key);
+        else cpu.releaseKey(key);
+    }
+    appliedKeys = keys;
+}
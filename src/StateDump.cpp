@@ -0,0 +1,163 @@
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../include/StateDump.hpp"
+
+namespace {
+
+// Bounds-checked cursor over the caller's buffer, stops writing once it is full
+class DumpWriter {
+    private:
+        char *position;
+        char *const end;
+        bool overflowed;
+
+    public:
+        DumpWriter(char *buffer, size_t size) : position(buffer), end(buffer+size), overflowed(false) {}
+        bool ok() const { return !overflowed; };
+        char *getPosition() const { return position; };
+
+        inline void bytes(void const *data, size_t size) {
+            if (overflowed || size > (size_t)(end-position)) {
+                overflowed = true;
+                return;
+            }
+            std::memcpy(position, data, size);
+            position += size;
+        }
+        // Little-endian integer
+        template <typename T>
+        inline void integer(T value) {
+            uint8_t data[sizeof(T)];
+            for (size_t i = 0; i < sizeof(T); i++) data[i] = (value >> (8*i)) & 0xFF;
+            bytes(data, sizeof(T));
+        }
+        inline void text(char const *string) { bytes(string, std::strlen(string)); }
+        inline void decimal(uint64_t value) {
+            char digits[20];
+            int count = 0;
+            do {
+                digits[sizeof(digits)-1-count++] = '0'+value%10;
+                value /= 10;
+            } while (value > 0);
+            bytes(digits+sizeof(digits)-count, count);
+        }
+        inline void hex(uint8_t const *data, size_t size) {
+            static char const digits[] = "0123456789ABCDEF";
+            if (overflowed || 2*size > (size_t)(end-position)) {
+                overflowed = true;
+                return;
+            }
+            for (size_t i = 0; i < size; i++) {
+                *position++ = digits[data[i] >> 4];
+                *position++ = digits[data[i] & 0xF];
+            }
+        }
+        template <typename T, size_t N>
+        inline void decimalArray(std::array<T, N> const &values) {
+            text("[");
+            for (size_t i = 0; i < N; i++) {
+                if (i > 0) text(",");
+                decimal(values[i]);
+            }
+            text("]");
+        }
+};
+
+} // namespace
+
+size_t dumpState(Cpu const &cpu, std::array<uint8_t, RAM_SIZE> const &ram, bool const *const screen, uint64_t frame,
+    DumpFormat format, uint8_t sections, char *buffer, size_t size) {
+    DumpWriter writer(buffer, size);
+    uint8_t packed[PACKED_SCREEN_SIZE];
+    if (sections & STATE_DUMP_SCREEN) packScreen(screen, packed);
+
+    if (format == DumpFormat::Binary) {
+        writer.integer<uint32_t>(STATE_DUMP_MAGIC);
+        writer.integer<uint8_t>(STATE_DUMP_VERSION);
+        writer.integer<uint8_t>(sections);
+        writer.integer<uint64_t>(frame);
+        writer.integer<uint16_t>(cpu.getPc());
+        writer.integer<uint16_t>(cpu.getRegI());
+        writer.bytes(cpu.getRegisters().data(), cpu.getRegisters().size());
+        for (uint16_t value : cpu.getStack()) writer.integer<uint16_t>(value);
+        writer.integer<uint8_t>(cpu.getStackPointer());
+        writer.integer<uint8_t>(cpu.getDelayTimer());
+        writer.integer<uint8_t>(cpu.getSoundTimer());
+        if (sections & STATE_DUMP_RAM) writer.bytes(ram.data(), ram.size());
+        if (sections & STATE_DUMP_SCREEN) writer.bytes(packed, sizeof(packed));
+    } else {
+        writer.text("{\"frame\":");
+        writer.decimal(frame);
+        writer.text(",\"pc\":");
+        writer.decimal(cpu.getPc());
+        writer.text(",\"i\":");
+        writer.decimal(cpu.getRegI());
+        writer.text(",\"v\":");
+        writer.decimalArray(cpu.getRegisters());
+        writer.text(",\"stack\":");
+        writer.decimalArray(cpu.getStack());
+        writer.text(",\"sp\":");
+        writer.decimal(cpu.getStackPointer());
+        writer.text(",\"dt\":");
+        writer.decimal(cpu.getDelayTimer());
+        writer.text(",\"st\":");
+        writer.decimal(cpu.getSoundTimer());
+        if (sections & STATE_DUMP_RAM) {
+            writer.text(",\"ram\":\"");
+            writer.hex(ram.data(), ram.size());
+            writer.text("\"");
+        }
+        if (sections & STATE_DUMP_SCREEN) {
+            writer.text(",\"screen\":\"");
+            writer.hex(packed, sizeof(packed));
+            writer.text("\"");
+        }
+        writer.text("}\n");
+    }
+    return writer.ok() ? writer.getPosition()-buffer : 0;
+}
+
+StateDumper::StateDumper(uint64_t interval, DumpFormat format, uint8_t sections) :
+    fd(-1),
+    ownsFd(false),
+    interval(interval),
+    format(format),
+    sections(sections),
+    buffer(STATE_DUMP_MAX_SIZE) {
+        TRACE("[DUMP: Creating new StateDumper " << this << "]");
+    }
+StateDumper::~StateDumper() {
+    TRACE("[DUMP: deleting StateDumper " << this << "]");
+    if (ownsFd && fd >= 0) close(fd);
+}
+
+bool StateDumper::open(char const *const path) {
+    if (path == nullptr) {
+        fd = STDERR_FILENO;
+        return true;
+    }
+    fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error! Could not open dump file " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    ownsFd = true;
+    return true;
+}
+
+void StateDumper::frame(Cpu const &cpu, std::array<uint8_t, RAM_SIZE> const &ram, bool const *const screen, uint64_t frame) {
+    if (fd < 0 || interval == 0 || frame % interval != 0) return;
+    size_t size = dumpState(cpu, ram, screen, frame, format, sections, buffer.data(), buffer.size());
+    char const *data = buffer.data();
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return; // Telemetry is best effort, never stop the emulator over it
+        }
+        data += written;
+        size -= written;
+    }
+}